@@ -0,0 +1,101 @@
+#include <cstring>
+#include <algorithm>
+
+#include "build_date.hpp"
+#include "flash_store.hpp"
+#include "amplitude_calibration.hpp"
+
+namespace {
+    static BuildDate build_date(__DATE__,__TIME__);
+
+    constexpr uint32_t amplitude_calibration_magic = 0x41434C31; // "ACL1"
+}
+
+AmplitudeCalibration* AmplitudeCalibration::the_singleton_ = nullptr;
+
+void AmplitudeCalibration::construct()
+{
+    static AmplitudeCalibration the_singleton;
+    the_singleton_ = &the_singleton;
+}
+
+AmplitudeCalibration::AmplitudeCalibration()
+{
+    if(not load()) {
+        reset();
+    }
+}
+
+void AmplitudeCalibration::compile(unsigned iled)
+{
+    // A requested amplitude of zero stays zero, so that calibration never
+    // makes an LED flash that was asked not to
+    int gain = constants_.gain[iled];
+    int offset = constants_.offset[iled];
+    table_[iled][0] = 0;
+    for(int amp=1; amp<256; ++amp) {
+        table_[iled][amp] = std::clamp(offset + (amp*gain + unit_gain/2) / unit_gain, 0, 255);
+    }
+}
+
+void AmplitudeCalibration::compile_all()
+{
+    for(unsigned iled=0; iled<num_leds; ++iled) {
+        compile(iled);
+    }
+}
+
+void AmplitudeCalibration::set_gain(int ar, int ac, int gain)
+{
+    constants_.gain[index(ar, ac)] = gain;
+    compile(index(ar, ac));
+}
+
+void AmplitudeCalibration::set_offset(int ar, int ac, int offset)
+{
+    constants_.offset[index(ar, ac)] = offset;
+    compile(index(ar, ac));
+}
+
+bool AmplitudeCalibration::assign_gains(const uint8_t* gains, unsigned ngain)
+{
+    if(ngain != num_leds) {
+        return false;
+    }
+    std::memcpy(constants_.gain, gains, num_leds);
+    compile_all();
+    return true;
+}
+
+bool AmplitudeCalibration::assign_offsets(const uint8_t* offsets, unsigned noffset)
+{
+    if(noffset != num_leds) {
+        return false;
+    }
+    std::memcpy(constants_.offset, offsets, num_leds);
+    compile_all();
+    return true;
+}
+
+void AmplitudeCalibration::reset()
+{
+    std::memset(constants_.gain, unit_gain, num_leds);
+    std::memset(constants_.offset, 0, num_leds);
+    compile_all();
+}
+
+bool AmplitudeCalibration::save() const
+{
+    return FlashStore::save(FlashStore::SLOT_AMPLITUDE_CALIBRATION, amplitude_calibration_magic,
+        &constants_, sizeof(constants_));
+}
+
+bool AmplitudeCalibration::load()
+{
+    if(not FlashStore::load(FlashStore::SLOT_AMPLITUDE_CALIBRATION, amplitude_calibration_magic,
+            &constants_, sizeof(constants_))) {
+        return false;
+    }
+    compile_all();
+    return true;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+
+// Per-LED calibration of the amplitude, so that LEDs of different efficiency
+// give the same light for the same requested amplitude. Each LED has a gain,
+// in units of 1/unit_gain, and an offset in DAC counts, which are compiled
+// into a table of the DAC code for every LED and requested amplitude. The
+// generators go through the table when they pack their patterns (see
+// EventGenerator::make_pattern), so calibration costs one lookup per flash.
+// The table is recompiled in place when the calibration changes, so events
+// generated while that is done may use the old or the new values.
+class AmplitudeCalibration
+{
+public:
+    static constexpr unsigned num_leds = 256;
+    static constexpr int unit_gain = 128;
+
+    static unsigned index(int ar, int ac) { return (ar & 0x0F)*16 + (ac & 0x0F); }
+    uint8_t code(int ar, int ac, int amp) const { return table_[index(ar, ac)][amp & 0xFF]; }
+
+    int gain(int ar, int ac) const { return constants_.gain[index(ar, ac)]; }
+    int offset(int ar, int ac) const { return constants_.offset[index(ar, ac)]; }
+    void set_gain(int ar, int ac, int gain);
+    void set_offset(int ar, int ac, int offset);
+    bool assign_gains(const uint8_t* gains, unsigned ngain);
+    bool assign_offsets(const uint8_t* offsets, unsigned noffset);
+    void reset();
+
+    bool save() const;
+    bool load();
+
+    // Constructed from main(), before the menus or the dispatcher start, so
+    // that instance() is a plain pointer on the hot path rather than the
+    // guard of a function-local static, and the flash read and compilation
+    // of the table are not done on whichever core packs a pattern first
+    static void construct();
+    static AmplitudeCalibration& instance() { return *the_singleton_; }
+private:
+    AmplitudeCalibration();
+    AmplitudeCalibration(AmplitudeCalibration&);
+    AmplitudeCalibration& operator=(AmplitudeCalibration const&);
+
+    void compile(unsigned iled);
+    void compile_all();
+
+    // Kept together so they can be stored as one block in the flash
+    struct Constants {
+        uint8_t gain[num_leds];
+        uint8_t offset[num_leds];
+    };
+
+    Constants constants_;
+    uint8_t table_[num_leds][256];
+
+    static AmplitudeCalibration* the_singleton_;
+};
@@ -0,0 +1,32 @@
+#include <algorithm>
+
+#include "build_date.hpp"
+#include "amplitude_ranges.hpp"
+
+namespace {
+    static BuildDate build_date(__DATE__,__TIME__);
+}
+
+AmplitudeRanges::AmplitudeRanges()
+{
+    // SCALE of each range, counting down from the top
+    unsigned scale[nrange];
+    unsigned range_scale = 256;
+    for(unsigned irange=num_ranges(); irange>0; --irange) {
+        scale[irange-1] = std::min(range_scale, 255U);
+        range_scale /= range_ratio();
+    }
+
+    // The largest amplitude is VDAC and SCALE both at 255
+    const uint32_t max_product = 255 * 255;
+    for(unsigned amplitude=0; amplitude<=max_amplitude(); ++amplitude) {
+        uint32_t product = (amplitude * max_product + max_amplitude()/2) / max_amplitude();
+        unsigned irange = 0;
+        uint32_t vdac = (product + scale[0]/2) / scale[0];
+        while(vdac > 255) {
+            ++irange;
+            vdac = (product + scale[irange]/2) / scale[irange];
+        }
+        table_[amplitude] = (scale[irange] << 8) | vdac;
+    }
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+
+// Maps logical amplitudes, wider than the 8-bit VDAC, onto (SCALE, VDAC)
+// pairs. The light from an LED goes as the product of the two settings, so
+// the amplitude range is split into num_ranges() ranges, each with a SCALE
+// setting range_ratio() times that of the one below, the top range having
+// SCALE at its maximum. Each amplitude goes to the lowest range that can
+// reach it, which keeps the most bits of the VDAC. The mapping is computed
+// once into a table, so generators pay one lookup per event.
+class AmplitudeRanges
+{
+public:
+    static unsigned amplitude_bits() { return 12; }
+    static unsigned max_amplitude() { return (1U << amplitude_bits()) - 1; }
+    static unsigned num_ranges() { return nrange; }
+    static unsigned range_ratio() { return 4; }
+
+    // SCALE and VDAC settings for an amplitude, packed as (scale << 8) | vdac
+    uint16_t lookup(unsigned amplitude) const { return table_[amplitude & max_amplitude()]; }
+    static int scale(uint16_t entry) { return entry >> 8; }
+    static int vdac(uint16_t entry) { return entry & 0xFF; }
+
+    static AmplitudeRanges& instance() {
+        static AmplitudeRanges the_singleton;
+        return the_singleton;
+    }
+private:
+    AmplitudeRanges();
+    AmplitudeRanges(AmplitudeRanges&);
+    AmplitudeRanges& operator=(AmplitudeRanges const&);
+
+    static const unsigned nrange = 4;
+
+    uint16_t table_[1U << 12];
+};
@@ -0,0 +1,198 @@
+#include "build_date.hpp"
+#include "menu.hpp"
+#include "input_menu.hpp"
+#include "calibration_menu.hpp"
+#include "amplitude_calibration.hpp"
+
+namespace {
+    static BuildDate build_date(__DATE__,__TIME__);
+}
+
+CalibrationMenu::CalibrationMenu() :
+    SimpleItemValueMenu(make_menu_items(), "Amplitude calibration menu")
+{
+    sync_values();
+}
+
+void CalibrationMenu::sync_values()
+{
+    AmplitudeCalibration& calibration = AmplitudeCalibration::instance();
+    gain_ = calibration.gain(ar_, ac_);
+    offset_ = calibration.offset(ar_, ac_);
+    set_rc_value(false);
+    set_gain_value(false);
+    set_offset_value(false);
+    set_amp_value(false);
+    set_code_value(false);
+}
+
+void CalibrationMenu::upload_table(bool gains)
+{
+    uint8_t values[AmplitudeCalibration::num_leds];
+    int nvalue = InputMenu::input_byte_table(values, AmplitudeCalibration::num_leds,
+        gains ? "Upload gains (rows A to P, 128 = unity)" : "Upload offsets (rows A to P)", this);
+    this->redraw();
+    if(nvalue < 0) {
+        return;
+    }
+    AmplitudeCalibration& calibration = AmplitudeCalibration::instance();
+    if(not (gains ? calibration.assign_gains(values, nvalue) : calibration.assign_offsets(values, nvalue))) {
+        beep();
+        return;
+    }
+    sync_values();
+    draw_item_value(MIP_GAIN);
+    draw_item_value(MIP_OFFSET);
+    draw_item_value(MIP_CODE);
+}
+
+void CalibrationMenu::set_rc_value(bool draw)
+{
+    rc_to_value_string(menu_items_[MIP_ROWCOL].value, ar_, ac_);
+    if(draw)draw_item_value(MIP_ROWCOL);
+}
+
+void CalibrationMenu::set_gain_value(bool draw)
+{
+    menu_items_[MIP_GAIN].value.assign_int(gain_);
+    if(draw)draw_item_value(MIP_GAIN);
+}
+
+void CalibrationMenu::set_offset_value(bool draw)
+{
+    menu_items_[MIP_OFFSET].value.assign_int(offset_);
+    if(draw)draw_item_value(MIP_OFFSET);
+}
+
+void CalibrationMenu::set_amp_value(bool draw)
+{
+    menu_items_[MIP_AMP].value.assign_int(amp_);
+    if(draw)draw_item_value(MIP_AMP);
+}
+
+void CalibrationMenu::set_code_value(bool draw)
+{
+    menu_items_[MIP_CODE].value.assign_int(AmplitudeCalibration::instance().code(ar_, ac_, amp_));
+    if(draw)draw_item_value(MIP_CODE);
+}
+
+void CalibrationMenu::set_flash_value(const char* status, bool draw)
+{
+    menu_items_[MIP_FLASH].value = status;
+    if(draw)draw_item_value(MIP_FLASH);
+}
+
+std::vector<SimpleItemValueMenu::MenuItem> CalibrationMenu::make_menu_items()
+{
+    std::vector<SimpleItemValueMenu::MenuItem> menu_items(MIP_NUM_ITEMS);
+    menu_items.at(MIP_ROWCOL)         = {"Cursors : Change column & row", 3, "A1"};
+    menu_items.at(MIP_GAIN)           = {"g       : Gain of LED (128 = unity)", 3, "128"};
+    menu_items.at(MIP_OFFSET)         = {"o       : Offset of LED (DAC counts)", 3, "0"};
+    menu_items.at(MIP_AMP)            = {"</>     : Decrease/increase requested amplitude", 3, "128"};
+    menu_items.at(MIP_CODE)           = {"DAC code for requested amplitude", 3, "128"};
+    menu_items.at(MIP_UPLOAD_GAINS)   = {"G       : Upload gains", 0, ""};
+    menu_items.at(MIP_UPLOAD_OFFSETS) = {"O       : Upload offsets", 0, ""};
+    menu_items.at(MIP_RESET)          = {"Z       : Reset to unity gain and zero offset", 0, ""};
+    menu_items.at(MIP_FLASH)          = {"W/L     : Write / load calibration in flash", 6, ""};
+    menu_items.at(MIP_EXIT)           = {"Q       : Exit menu", 0, ""};
+    return menu_items;
+}
+
+bool CalibrationMenu::controller_connected(int& return_code)
+{
+    return_code = 0;
+    return true;
+}
+
+bool CalibrationMenu::controller_disconnected(int& return_code)
+{
+    return_code = 0;
+    return true;
+}
+
+bool CalibrationMenu::process_key_press(int key, int key_count, int& return_code,
+    const std::vector<std::string>& escape_sequence_parameters, absolute_time_t& next_timer)
+{
+    AmplitudeCalibration& calibration = AmplitudeCalibration::instance();
+    if(process_rc_keys(ar_, ac_, key, key_count)) {
+        sync_values();
+        draw_item_value(MIP_ROWCOL);
+        draw_item_value(MIP_GAIN);
+        draw_item_value(MIP_OFFSET);
+        draw_item_value(MIP_CODE);
+        return true;
+    }
+
+    switch (key) {
+        case '<':
+            decrease_value_in_range(amp_, 0, (key_count >= 15 ? 5 : 1), key_count==1);
+            set_amp_value();
+            set_code_value();
+            break;
+        case '>':
+            increase_value_in_range(amp_, 255, (key_count >= 15 ? 5 : 1), key_count==1);
+            set_amp_value();
+            set_code_value();
+            break;
+        case 'g':
+            if(InplaceInputMenu::input_value_in_range(gain_, 0, 255, this, MIP_GAIN, 3)) {
+                calibration.set_gain(ar_, ac_, gain_);
+            }
+            set_gain_value();
+            set_code_value();
+            break;
+        case 'o':
+            if(InplaceInputMenu::input_value_in_range(offset_, 0, 255, this, MIP_OFFSET, 3)) {
+                calibration.set_offset(ar_, ac_, offset_);
+            }
+            set_offset_value();
+            set_code_value();
+            break;
+        case 'G':
+            upload_table(true);
+            break;
+        case 'O':
+            upload_table(false);
+            break;
+        case 'Z':
+            calibration.reset();
+            sync_values();
+            draw_item_value(MIP_GAIN);
+            draw_item_value(MIP_OFFSET);
+            draw_item_value(MIP_CODE);
+            break;
+        case 'W':
+            set_flash_value(calibration.save() ? "saved" : "FAILED");
+            break;
+        case 'L':
+            if(calibration.load()) {
+                sync_values();
+                draw_item_value(MIP_GAIN);
+                draw_item_value(MIP_OFFSET);
+                draw_item_value(MIP_CODE);
+                set_flash_value("loaded");
+            } else {
+                set_flash_value("FAILED");
+            }
+            break;
+        case 'q':
+        case 'Q':
+            return_code = 0;
+            return false;
+        default:
+            beep();
+    }
+    return true;
+}
+
+bool CalibrationMenu::process_timer(bool controller_is_connected, int& return_code, absolute_time_t& next_timer)
+{
+    heartbeat_timer_count_ += 1;
+    if(heartbeat_timer_count_ == 100) {
+        if(controller_is_connected) {
+            set_heartbeat(!heartbeat_);
+        }
+        heartbeat_timer_count_ = 0;
+    }
+    return true;
+}
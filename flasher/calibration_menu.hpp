@@ -0,0 +1,53 @@
+#pragma once
+
+#include <vector>
+
+#include <pico/stdlib.h>
+
+#include "flasher.hpp"
+#include "menu.hpp"
+
+class CalibrationMenu: public SimpleItemValueMenu {
+public:
+    CalibrationMenu();
+    virtual ~CalibrationMenu() { }
+    bool controller_connected(int& return_code) final;
+    bool controller_disconnected(int& return_code) final;
+    bool process_key_press(int key, int key_count, int& return_code,
+        const std::vector<std::string>& escape_sequence_parameters, absolute_time_t& next_timer) final;
+    bool process_timer(bool controller_is_connected, int& return_code, absolute_time_t& next_timer) final;
+
+private:
+    enum MenuItemPositions {
+        MIP_ROWCOL,
+        MIP_GAIN,
+        MIP_OFFSET,
+        MIP_AMP,
+        MIP_CODE,
+        MIP_EMPTY_LINE,
+        MIP_UPLOAD_GAINS,
+        MIP_UPLOAD_OFFSETS,
+        MIP_RESET,
+        MIP_FLASH,
+        MIP_EXIT,
+        MIP_NUM_ITEMS // MUST BE LAST ITEM IN LIST
+    };
+
+    std::vector<MenuItem> make_menu_items();
+
+    void sync_values();
+    void upload_table(bool gains);
+    void set_rc_value(bool draw = true);
+    void set_gain_value(bool draw = true);
+    void set_offset_value(bool draw = true);
+    void set_amp_value(bool draw = true);
+    void set_code_value(bool draw = true);
+    void set_flash_value(const char* status, bool draw = true);
+
+    int gain_ = 0;
+    int offset_ = 0;
+    int amp_ = 128;
+    int ac_ = 0;
+    int ar_ = 0;
+    unsigned heartbeat_timer_count_ = 0;
+};
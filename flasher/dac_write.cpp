@@ -0,0 +1,95 @@
+#include <algorithm>
+
+#include <hardware/gpio.h>
+#include <hardware/clocks.h>
+
+#include "build_date.hpp"
+#include "flasher.hpp"
+#include "dac_write.hpp"
+#include "dac_write.pio.h"
+
+namespace {
+    static BuildDate build_date(__DATE__,__TIME__);
+}
+
+uint32_t DACWriteEngine::pin_mask()
+{
+    return (0x000003 << DAC_SEL_BASE_PIN) | (0x0000FF << VDAC_BASE_PIN) | (0x1U << DAC_WR_PIN);
+}
+
+uint32_t DACWriteEngine::write_duration_ns()
+{
+    return DAC_WRITE_CYCLES_PER_WRITE * cycle_ns();
+}
+
+bool DACWriteEngine::add_write(DAC dac, int value)
+{
+    if(nwrite_ == max_writes) {
+        return false;
+    }
+    writes_[nwrite_++] = (uint32_t(dac) & 0x03) | (uint32_t(value & 0xFF) << DAC_WRITE_VALUE_SHIFT);
+    return true;
+}
+
+bool DACWriteEngine::start()
+{
+    if(running_) {
+        stop();
+    }
+    if(nwrite_ == 0) {
+        return false;
+    }
+
+    for(unsigned i=0; i<32; ++i) {
+        if(pin_mask() & (1U << i)) {
+            saved_function_[i] = gpio_get_function(i);
+        }
+    }
+
+    transfer_.claim(pio1, &dac_write_program);
+    float clkdiv = std::max(float(clock_get_hz(clk_sys)) * float(cycle_ns()) * 1e-9f, 1.0f);
+    dac_write_program_init(transfer_.pio(), transfer_.sm(), transfer_.offset(),
+        DAC_SEL_BASE_PIN, VDAC_BASE_PIN, DAC_WR_PIN, clkdiv);
+    transfer_.start_once(writes_, nwrite_);
+    running_ = true;
+    return true;
+}
+
+void DACWriteEngine::stop()
+{
+    if(not running_) {
+        return;
+    }
+    transfer_.release();
+
+    // Leave the select and VDAC pins as the last write set them, with DAC_WR
+    // low, so handing them back does not disturb the DACs
+    uint32_t last = writes_[nwrite_-1];
+    gpio_put_masked(pin_mask(), ((last & 0x03) << DAC_SEL_BASE_PIN)
+        | (((last >> DAC_WRITE_VALUE_SHIFT) & 0xFF) << VDAC_BASE_PIN));
+    for(unsigned i=0; i<32; ++i) {
+        if(pin_mask() & (1U << i)) {
+            gpio_set_function(i, saved_function_[i]);
+        }
+    }
+    running_ = false;
+}
+
+bool DACWriteEngine::is_busy()
+{
+    if(running_ and transfer_.is_finished()) {
+        stop();
+    }
+    return running_;
+}
+
+bool DACWriteEngine::write_blocking()
+{
+    if(not start()) {
+        return false;
+    }
+    while(is_busy()) {
+        tight_loop_contents();
+    }
+    return true;
+}
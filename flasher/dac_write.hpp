@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+
+#include <hardware/gpio.h>
+
+#include "pio_dma_transfer.hpp"
+
+// Writes to the MAIN, SCALE and TRIM DACs with the dac_write state machine.
+// The writes are queued as (dac, value) records, which DMA feeds to the state
+// machine once the transfer is started, so the select, data and DAC_WR timing
+// is done in hardware in write_duration_ns() per write. The CPU does not have
+// to wait, is_busy() hands the pins back once the last write is done. The
+// select and VDAC pins are left with the values of the last write, and all
+// pins are returned to whichever function they had before the transfer.
+class DACWriteEngine
+{
+public:
+    enum DAC { DAC_MAIN = 0, DAC_SCALE = 1, DAC_SPARE = 2, DAC_TRIM = 3 };
+
+    void clear() { nwrite_ = 0; }
+    bool add_write(DAC dac, int value);
+    unsigned num_writes() const { return nwrite_; }
+
+    bool start();
+    void stop();
+    bool is_busy();
+
+    // Start the transfer and wait for it, for callers that have to set other
+    // pins once the DACs are written
+    bool write_blocking();
+
+    static uint32_t cycle_ns() { return 20; }
+    static uint32_t write_duration_ns();
+
+    static DACWriteEngine& instance() {
+        static DACWriteEngine the_singleton;
+        return the_singleton;
+    }
+private:
+    DACWriteEngine() { }
+    DACWriteEngine(DACWriteEngine&);
+    DACWriteEngine& operator=(DACWriteEngine const&);
+
+    static uint32_t pin_mask();
+
+    static const unsigned max_writes = 64;
+
+    PIODMATransfer transfer_;
+    bool running_ = false;
+    gpio_function_t saved_function_[32];
+
+    uint32_t writes_[max_writes];
+    unsigned nwrite_ = 0;
+};
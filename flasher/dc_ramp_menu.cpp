@@ -1,7 +1,10 @@
+#include <cmath>
+
 #include "build_date.hpp"
 #include "menu.hpp"
 #include "input_menu.hpp"
 #include "dc_ramp_menu.hpp"
+#include "vdac_waveform.hpp"
 
 namespace {
     static BuildDate build_date(__DATE__,__TIME__);
@@ -31,31 +34,31 @@ void DCRampMenu::set_rc_value(bool draw)
 
 void DCRampMenu::set_scale_value(bool draw) 
 { 
-    menu_items_[MIP_SCALE_DAC].value = std::to_string(scale_); 
+    menu_items_[MIP_SCALE_DAC].value.assign_int(scale_);
     if(draw)draw_item_value(MIP_SCALE_DAC);
 }
 
 void DCRampMenu::set_offset_value(bool draw) 
 { 
-    menu_items_[MIP_TRIM_DAC].value = std::to_string(offset_); 
+    menu_items_[MIP_TRIM_DAC].value.assign_int(offset_);
     if(draw)draw_item_value(MIP_TRIM_DAC);
 }
 
 void DCRampMenu::set_ramp_up_time_value(bool draw) 
 { 
-    menu_items_[MIP_RAMP_UP].value = std::to_string(ramp_up_time_); 
+    menu_items_[MIP_RAMP_UP].value.assign_fixed(std::lround(ramp_up_time_*1000), 3);
     if(draw)draw_item_value(MIP_RAMP_UP);
 }
 
 void DCRampMenu::set_ramp_hold_time_value(bool draw) 
 { 
-    menu_items_[MIP_RAMP_HOLD].value = std::to_string(ramp_hold_time_); 
+    menu_items_[MIP_RAMP_HOLD].value.assign_fixed(std::lround(ramp_hold_time_*1000), 3);
     if(draw)draw_item_value(MIP_RAMP_HOLD);
 }
 
 void DCRampMenu::set_ramp_down_time_value(bool draw) 
 { 
-    menu_items_[MIP_RAMP_DOWN].value = std::to_string(ramp_down_time_); 
+    menu_items_[MIP_RAMP_DOWN].value.assign_fixed(std::lround(ramp_down_time_*1000), 3);
     if(draw)draw_item_value(MIP_RAMP_DOWN);
 }
 
@@ -75,84 +78,45 @@ void DCRampMenu::set_phase_value(bool draw)
 
 void DCRampMenu::set_time_value(bool draw) 
 { 
-    menu_items_[MIP_TIME].value = std::to_string(time_/100); 
+    menu_items_[MIP_TIME].value.assign_fixed(time_ms_, 3);
     if(draw)draw_item_value(MIP_TIME);
 }
 
 void DCRampMenu::set_vdac_value(bool draw) 
 { 
-    menu_items_[MIP_VDAC].value = std::to_string(vdac_); 
+    menu_items_[MIP_VDAC].value.assign_int(vdac_);
     if(draw)draw_item_value(MIP_VDAC);
 }
 
-void DCRampMenu::delay()
-{
-    sleep_us(1);
-}
-
-void DCRampMenu::configure_ramp()
-{
-    gpio_put(DAC_EN_PIN, 0);
-    gpio_put(DAC_WR_PIN, 0);
-    delay();
-
-    gpio_put_masked(0x000003 << DAC_SEL_BASE_PIN, 1 << DAC_SEL_BASE_PIN);
-    gpio_put_masked(0x0000FF << VDAC_BASE_PIN, scale_ << VDAC_BASE_PIN);
-    delay();
-    gpio_put(DAC_WR_PIN, 1);
-    delay();
-    gpio_put(DAC_WR_PIN, 0);
-    delay();
-
-    gpio_put_masked(0x000003 << DAC_SEL_BASE_PIN, 3 << DAC_SEL_BASE_PIN);
-    gpio_put_masked(0x0000FF << VDAC_BASE_PIN, offset_ << VDAC_BASE_PIN);
-    delay();
-    gpio_put(DAC_WR_PIN, 1);
-    delay();
-    gpio_put(DAC_WR_PIN, 0);
-    delay();
-
-    gpio_put_masked(0x000003 << DAC_SEL_BASE_PIN, 0 << DAC_SEL_BASE_PIN);
-    gpio_put_masked(0x0000FF << VDAC_BASE_PIN, 0 << VDAC_BASE_PIN);
-    delay();
-    gpio_put_masked(0x00000F << ROW_A_BASE_PIN, ar_ << ROW_A_BASE_PIN);
-    gpio_put_masked(0x00000F << COL_A_BASE_PIN, ac_ << COL_A_BASE_PIN);
-    delay();
-    gpio_put(DAC_EN_PIN, 1);
-    gpio_put(DAC_WR_PIN, 1);
-    gpio_put(TRIG_PIN, 1);
-}
-
-void DCRampMenu::unconfigure_ramp()
-{
-    gpio_put(DAC_EN_PIN, 0);
-    gpio_put(DAC_WR_PIN, 0);
-    delay();
-    gpio_put_masked(0x0000FF << VDAC_BASE_PIN, 0 << VDAC_BASE_PIN);
-    gpio_put_masked(0x00000F << ROW_A_BASE_PIN, 0 << ROW_A_BASE_PIN);
-    gpio_put_masked(0x00000F << COL_A_BASE_PIN, 0 << COL_A_BASE_PIN);
-    delay();
-    gpio_put(TRIG_PIN, 0);
-}
-
 std::vector<SimpleItemValueMenu::MenuItem> DCRampMenu::make_menu_items() 
 {
     std::vector<SimpleItemValueMenu::MenuItem> menu_items(MIP_NUM_ITEMS);
     menu_items.at(MIP_PHASE)       = {"Phase", 4, "OFF"};
-    menu_items.at(MIP_TIME)        = {"Time (s)", 5, "0"};
+    menu_items.at(MIP_TIME)        = {"Time (s)", 8, "0.000"};
     menu_items.at(MIP_VDAC)        = {"Intensity", 3, "0"};
 
     menu_items.at(MIP_ROWCOL)      = {"Cursors : Change column & row", 3, "A1"};
     menu_items.at(MIP_SCALE_DAC)   = {"</s/>   : Ramp scale", 3, "0"};
     menu_items.at(MIP_TRIM_DAC)    = {"-/o/+   : Ramp offset", 3, "0"};
-    menu_items.at(MIP_RAMP_UP)     = {"u       : Ramp-up time (s)", 5, "3.00"};
-    menu_items.at(MIP_RAMP_HOLD)   = {"h       : Hold time (s)", 5, "5.00"};
-    menu_items.at(MIP_RAMP_DOWN)   = {"d       : Ramp-down time (s)", 5, "3.00"};
+    menu_items.at(MIP_RAMP_UP)     = {"u       : Ramp-up time (s)", 8, "3.000"};
+    menu_items.at(MIP_RAMP_HOLD)   = {"h       : Hold time (s)", 8, "5.000"};
+    menu_items.at(MIP_RAMP_DOWN)   = {"d       : Ramp-down time (s)", 8, "3.000"};
     menu_items.at(MIP_ENABLE_RAMP) = {"E       : Enable / disable ramp", 8, "disable"};
     menu_items.at(MIP_EXIT)        = {"Q       : Exit menu", 0, ""};
     return menu_items;
 }
 
+void DCRampMenu::event_loop_finishing(int& return_code)
+{
+    // Nothing polls the engine once the menu has gone, so stop the ramp
+    // however the menu is left
+    if(enable_ramp_) {
+        VDACWaveformEngine::instance().stop();
+        VDACWaveformEngine::unconfigure_dac();
+        enable_ramp_ = false;
+    }
+}
+
 bool DCRampMenu::controller_connected(int& return_code)
 {
     return_code = 0;
@@ -171,21 +135,10 @@ bool DCRampMenu::process_key_press(int key, int key_count, int& return_code,
     if(enable_ramp_ == true) {
         switch(key) {
             case 'E':
-                phase_ = 0;
-                time_ = 0;
-                vdac_ = 0;
-                set_phase_value();
-                set_time_value();
-                set_vdac_value();
-                enable_ramp_ = false;
-                set_enable_ramp_value();
-                unconfigure_ramp();
+                stop_ramp();
                 break;
+            case 'q':
             case 'Q':
-                phase_ = 0;
-                time_ = 0;
-                vdac_ = 0;
-                unconfigure_ramp();
                 return_code = 0;
                 return false;
             default:
@@ -260,7 +213,7 @@ bool DCRampMenu::process_key_press(int key, int key_count, int& return_code,
                 InplaceInputMenu input(rc_getter, 5, VI_POSITIVE_FLOAT, true, this);
                 if(input.event_loop()==1 and input.get_value().size()!=0) {
                     float val = std::stof(input.get_value());
-                    if(val>=0.1 and val<=1000) {
+                    if(val>=0.001 and val<=1000) {
                         ramp_up_time_ = val;
                     } else {
                         beep();
@@ -298,7 +251,7 @@ bool DCRampMenu::process_key_press(int key, int key_count, int& return_code,
                 InplaceInputMenu input(rc_getter, 5, VI_POSITIVE_FLOAT, true, this);
                 if(input.event_loop()==1 and input.get_value().size()!=0) {
                     float val = std::stof(input.get_value());
-                    if(val>=0.1 and val<=1000) {
+                    if(val>=0.001 and val<=1000) {
                         ramp_down_time_ = val;
                     } else {
                         beep();
@@ -311,9 +264,7 @@ bool DCRampMenu::process_key_press(int key, int key_count, int& return_code,
             }
             break;
         case 'E':
-            configure_ramp();
-            enable_ramp_ = true;
-            set_enable_ramp_value();
+            start_ramp();
             break;
         case 'q':
         case 'Q':
@@ -339,45 +290,68 @@ bool DCRampMenu::process_timer(bool controller_is_connected, int& return_code, a
         heartbeat_timer_count_ = 0;
     }
 
-    if (enable_ramp_ == true){
-        time_ += 1;
-        set_time_value();
-        if (time_ < ramp_up_time_*100){
-            phase_ = 1;
-            set_phase_value();
-            vdac_ = (255 / (ramp_up_time_*100)) * time_;
-            gpio_put_masked(0x0000FF << VDAC_BASE_PIN, vdac_ << VDAC_BASE_PIN);
-            set_vdac_value();
+    if(enable_ramp_) {
+        if(not VDACWaveformEngine::instance().is_running()) {
+            stop_ramp();
+        } else if(++progress_timer_count_ >= progress_display_ticks()) {
+            update_ramp_progress();
+            progress_timer_count_ = 0;
         }
+    }
+    return true;
+}
 
-        if (ramp_up_time_*100 <= time_ and time_ <= ramp_up_time_*100 + ramp_hold_time_*100){
-            phase_ = 2;
-            set_phase_value();
-            vdac_ = 255;
-            gpio_put_masked(0x0000FF << VDAC_BASE_PIN, vdac_ << VDAC_BASE_PIN);
-            set_vdac_value();
-        }
+void DCRampMenu::start_ramp()
+{
+    VDACWaveformEngine& engine = VDACWaveformEngine::instance();
+    engine.clear_waveform();
+    if(not engine.add_linear_segment(255, std::lround(ramp_up_time_*1e6))
+            or not engine.add_hold(std::lround(ramp_hold_time_*1e6))
+            or not engine.add_linear_segment(0, std::lround(ramp_down_time_*1e6))) {
+        beep();
+        return;
+    }
+    VDACWaveformEngine::configure_dac(scale_, offset_, ar_, ac_);
+    if(not engine.play(1)) {
+        VDACWaveformEngine::unconfigure_dac();
+        beep();
+        return;
+    }
+    enable_ramp_ = true;
+    progress_timer_count_ = 0;
+    set_enable_ramp_value();
+    update_ramp_progress();
+}
 
-        if (ramp_up_time_*100 + ramp_hold_time_*100 < time_ and ramp_up_time_*100 + ramp_hold_time_*100 + ramp_down_time_*100 > time_){
-            phase_ = 3;
-            set_phase_value();
-            vdac_ = (-255 / (ramp_down_time_*100)) * (time_ - (ramp_up_time_*100 + ramp_hold_time_*100)) + 255;
-            gpio_put_masked(0x0000FF << VDAC_BASE_PIN, vdac_ << VDAC_BASE_PIN);
-            set_vdac_value();
-        }
+void DCRampMenu::stop_ramp()
+{
+    VDACWaveformEngine::instance().stop();
+    enable_ramp_ = false;
+    phase_ = 0;
+    time_ms_ = 0;
+    vdac_ = 0;
+    gpio_put_masked(0x0000FF << VDAC_BASE_PIN, vdac_ << VDAC_BASE_PIN);
+    VDACWaveformEngine::unconfigure_dac();
+    set_enable_ramp_value();
+    set_phase_value();
+    set_time_value();
+    set_vdac_value();
+}
 
-        if (time_ > ramp_up_time_*100 + ramp_hold_time_*100 + ramp_down_time_*100){
-            enable_ramp_ = false;
-            phase_ = 0;
-            time_ = 0;
-            vdac_ = 0;
-            gpio_put_masked(0x0000FF << VDAC_BASE_PIN, vdac_ << VDAC_BASE_PIN);
-            set_enable_ramp_value();
-            set_phase_value();
-            set_time_value();
-            set_vdac_value();
-            unconfigure_ramp();
-        }
+void DCRampMenu::update_ramp_progress()
+{
+    VDACWaveformEngine& engine = VDACWaveformEngine::instance();
+    uint64_t t = engine.elapsed_us();
+    if(t < uint64_t(std::llround(ramp_up_time_*1e6))) {
+        phase_ = 1;
+    } else if(t < uint64_t(std::llround((ramp_up_time_+ramp_hold_time_)*1e6))) {
+        phase_ = 2;
+    } else {
+        phase_ = 3;
     }
-    return true;
-}
\ No newline at end of file
+    time_ms_ = t / 1000;
+    vdac_ = (gpio_get_all() >> VDAC_BASE_PIN) & 0x0000FF;
+    set_phase_value();
+    set_time_value();
+    set_vdac_value();
+}
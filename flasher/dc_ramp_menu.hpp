@@ -11,6 +11,7 @@ class DCRampMenu: public SimpleItemValueMenu {
 public:
     DCRampMenu();
     virtual ~DCRampMenu() { }
+    void event_loop_finishing(int& return_code) final;
     bool controller_connected(int& return_code) final;
     bool controller_disconnected(int& return_code) final;
     bool process_key_press(int key, int key_count, int& return_code,
@@ -47,9 +48,10 @@ private:
     void set_phase_value(bool draw = true);
     void set_time_value(bool draw = true);
     void set_vdac_value(bool draw = true);
-    void delay();
-    void configure_ramp();
-    void unconfigure_ramp();
+    void start_ramp();
+    void stop_ramp();
+    void update_ramp_progress();
+    static unsigned progress_display_ticks() { return 10; } // 10Hz
 
     int scale_ = 0;
     int offset_ = 0;
@@ -60,7 +62,8 @@ private:
     float ramp_up_time_ = 3;
     float ramp_hold_time_ = 5;
     float ramp_down_time_ = 3;
-    float time_ = 0;
+    uint32_t time_ms_ = 0;
     bool enable_ramp_ = 0;
     unsigned heartbeat_timer_count_ = 0;
+    unsigned progress_timer_count_ = 0;
 };
\ No newline at end of file
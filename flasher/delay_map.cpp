@@ -0,0 +1,87 @@
+#include <cstring>
+
+#include "build_date.hpp"
+#include "flash_store.hpp"
+#include "spi_delay.hpp"
+#include "delay_map.hpp"
+
+namespace {
+    static BuildDate build_date(__DATE__,__TIME__);
+
+    constexpr uint32_t delay_map_magic = 0x444C4D31; // "DLM1"
+}
+
+DelayMap::DelayMap()
+{
+    if(not load()) {
+        fill(0);
+    }
+}
+
+void DelayMap::fill(int delay)
+{
+    std::memset(delay_, delay, num_leds);
+}
+
+bool DelayMap::assign(const uint8_t* delays, unsigned ndelay)
+{
+    if(ndelay != num_leds) {
+        return false;
+    }
+    std::memcpy(delay_, delays, num_leds);
+    return true;
+}
+
+unsigned DelayMap::num_changed() const
+{
+    if(not programmed_valid_) {
+        return num_leds;
+    }
+    unsigned nchanged = 0;
+    for(unsigned i=0; i<num_leds; ++i) {
+        nchanged += (delay_[i] != programmed_[i]);
+    }
+    return nchanged;
+}
+
+int DelayMap::apply()
+{
+    SPIDelayEngine& engine = SPIDelayEngine::instance();
+    if(engine.is_busy()) {
+        return -1;
+    }
+
+    unsigned nchanged = num_changed();
+    if(nchanged == 0) {
+        return 0;
+    }
+
+    // One broadcast replaces any number of changes when all LEDs share the
+    // same delay, otherwise only the LEDs that changed are written
+    engine.clear();
+    if(std::memcmp(delay_, delay_+1, num_leds-1) == 0) {
+        engine.add_broadcast(delay_[0]);
+    } else {
+        for(unsigned i=0; i<num_leds; ++i) {
+            if(not programmed_valid_ or delay_[i] != programmed_[i]) {
+                engine.add_led(i/16, i%16, delay_[i]);
+            }
+        }
+    }
+    if(not engine.start()) {
+        return -1;
+    }
+    std::memcpy(programmed_, delay_, num_leds);
+    programmed_valid_ = true;
+    return engine.num_records();
+}
+
+bool DelayMap::save() const
+{
+    return FlashStore::save(FlashStore::SLOT_DELAY_MAP, delay_map_magic, delay_, num_leds);
+}
+
+bool DelayMap::load()
+{
+    return FlashStore::load(FlashStore::SLOT_DELAY_MAP, delay_map_magic, delay_, num_leds);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+
+// Delays of all 256 LEDs, indexed by row and column. The map remembers what
+// was last written to the LEDs, so that applying it reprograms only the LEDs
+// whose delay has changed, or broadcasts the delay over SPI_ALL_EN when all
+// LEDs share one. What the LEDs hold is unknown at power up, so the first
+// apply programs every LED.
+class DelayMap
+{
+public:
+    static constexpr unsigned num_leds = 256;
+
+    static unsigned index(int ar, int ac) { return (ar & 0x0F)*16 + (ac & 0x0F); }
+    int get(int ar, int ac) const { return delay_[index(ar, ac)]; }
+    void set(int ar, int ac, int delay) { delay_[index(ar, ac)] = delay; }
+    void fill(int delay);
+    bool assign(const uint8_t* delays, unsigned ndelay);
+
+    // Number of LEDs whose delay differs from what they were last programmed
+    // with, all of them if that is not known
+    unsigned num_changed() const;
+    void invalidate_programmed() { programmed_valid_ = false; }
+
+    // Queue the changes with SPIDelayEngine and start it, returning the
+    // number of records queued, or -1 if the engine could not be started
+    int apply();
+
+    bool save() const;
+    bool load();
+
+    static DelayMap& instance() {
+        static DelayMap the_singleton;
+        return the_singleton;
+    }
+private:
+    DelayMap();
+    DelayMap(DelayMap&);
+    DelayMap& operator=(DelayMap const&);
+
+    uint8_t delay_[num_leds];
+    uint8_t programmed_[num_leds];
+    bool programmed_valid_ = false;
+};
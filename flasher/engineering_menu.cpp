@@ -5,6 +5,7 @@
 #include "build_date.hpp"
 #include "menu.hpp"
 #include "input_menu.hpp"
+#include "dac_write.hpp"
 #include "engineering_menu.hpp"
 
 namespace {
@@ -48,7 +49,7 @@ void EngineeringMenu::sync_values()
 
 void EngineeringMenu::set_vdac_value(bool draw) 
 { 
-    menu_items_[MIP_VDAC].value = std::to_string(vdac_); 
+    menu_items_[MIP_VDAC].value.assign_int(vdac_);
     if(draw)draw_item_value(MIP_VDAC);
 }
 
@@ -128,8 +129,8 @@ void EngineeringMenu::set_measured_temp_value(bool draw)
         constexpr float C0 = (27.0f + 0.706/0.001721f)*10.0f;
         constexpr float C1 = -ADC_REF_VOLTAGE/4096.0f/0.001721f*10.0f;
         uint16_t result = adc_read();
-        float temp = floor(C0 - float(result) * C1) * 0.1f;
-        menu_items_[MIP_TEMPERATURE].value = std::to_string(temp); 
+        int32_t temp_x10 = floor(C0 - float(result) * C1);
+        menu_items_[MIP_TEMPERATURE].value.assign_fixed(temp_x10, 1);
     } else {
        menu_items_[MIP_TEMPERATURE].value = "off"; 
     }
@@ -146,6 +147,7 @@ std::vector<SimpleItemValueMenu::MenuItem> EngineeringMenu::make_menu_items()
     menu_items.at(MIP_DAC_EN)      = {"V       : Toggle DAC voltage distribution", 4, "off"};
     menu_items.at(MIP_DAC_SEL)     = {"C       : Cycle between DACs", 5, "MAIN"};
     menu_items.at(MIP_DAC_WR)      = {"W       : Toggle DAC write enable", 4, "off"};
+    menu_items.at(MIP_DAC_WRITE)   = {"X       : Write DAC setting to selected DAC", 0, ""};
 
     menu_items.at(MIP_TOGGLE_TRIG) = {"T       : Toggle trigger", 4, "off"};
     menu_items.at(MIP_PULSE_TRIG)  = {"P       : Pulse trigger", 0, ""};
@@ -217,6 +219,20 @@ bool EngineeringMenu::process_key_press(int key, int key_count, int& return_code
         gpio_put_masked(0x000003 << DAC_SEL_BASE_PIN, dac_sel_ << DAC_SEL_BASE_PIN);
         set_dac_sel_value();
         break;
+    case 'X':
+        {
+            // Strobe DAC_WR in hardware, the select and VDAC pins are left
+            // as they were set here
+            DACWriteEngine& dac_writer = DACWriteEngine::instance();
+            dac_writer.clear();
+            dac_writer.add_write(DACWriteEngine::DAC(dac_sel_), vdac_);
+            if(not dac_writer.write_blocking()) {
+                beep();
+            }
+            dac_wr_ = false;
+            set_dac_wr_value();
+        }
+        break;
 
     case 'T':
         trig_ = !trig_;
@@ -228,9 +244,11 @@ bool EngineeringMenu::process_key_press(int key, int key_count, int& return_code
         gpio_put(TRIG_PIN, 0);
         trig_ = 1;
         set_trig_value();
-        sleep_ms(100);
-        trig_ = 0;
-        set_trig_value();
+        schedule_action(100000, [](Menu* menu) {
+            EngineeringMenu* engineering_menu = static_cast<EngineeringMenu*>(menu);
+            engineering_menu->trig_ = 0;
+            engineering_menu->set_trig_value();
+        }, this);
         break;
 
     case 'K':
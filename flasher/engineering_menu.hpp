@@ -23,6 +23,7 @@ private:
         MIP_DAC_EN,
         MIP_DAC_SEL,
         MIP_DAC_WR,
+        MIP_DAC_WRITE,
         MIP_TOGGLE_TRIG,
         MIP_PULSE_TRIG,
         MIP_SPI_CLK,
@@ -0,0 +1,175 @@
+#include <array>
+#include <algorithm>
+
+#include "build_date.hpp"
+#include "key_codes.hpp"
+#include "escape_decoder.hpp"
+
+namespace {
+    static BuildDate build_date(__DATE__,__TIME__);
+
+    enum ByteClass : uint8_t { BC_OTHER, BC_DIGIT, BC_SEPARATOR, BC_INTERMEDIATE, BC_FINAL };
+
+    struct KeyMapping {
+        int code;
+        int key;
+    };
+
+    // See https://www.gnu.org/software/screen/manual/html_node/Input-Translation.html#Input-Translation
+    constexpr KeyMapping ss3_keys[] = {
+        { 'A', KeyCodes::KEY_UP }, { 'B', KeyCodes::KEY_DOWN }, { 'C', KeyCodes::KEY_RIGHT },
+        { 'D', KeyCodes::KEY_LEFT }, { 'H', KeyCodes::KEY_HOME }, { 'F', KeyCodes::KEY_END },
+        { 'P', KeyCodes::KEY_F1 }, { 'Q', KeyCodes::KEY_F2 }, { 'R', KeyCodes::KEY_F3 },
+        { 'S', KeyCodes::KEY_F4 }, { 'p', '0' }, { 'q', '1' }, { 'r', '2' }, { 's', '3' },
+        { 't', '4' }, { 'u', '5' }, { 'v', '6' }, { 'w', '7' }, { 'x', '8' },
+        { 'y', '9' }, { 'k', '+' }, { 'm', '-' }, { 'j', '*' }, { 'o', '/' },
+        { 'X', '=' }, { 'n', '.' }, { 'l', ',' }, { 'M', '\r' } };
+
+    constexpr KeyMapping csi_keys[] = {
+        { 'A', KeyCodes::KEY_UP }, { 'B', KeyCodes::KEY_DOWN }, { 'C', KeyCodes::KEY_RIGHT },
+        { 'D', KeyCodes::KEY_LEFT }, { 'F', KeyCodes::KEY_END }, { 'H', KeyCodes::KEY_HOME },
+        { 'R', KeyCodes::CURSOR_POSITION_REPORT } };
+
+    // Keys sent as "ESC [ n ~", indexed by n
+    constexpr KeyMapping tilde_keys[] = {
+        { 1, KeyCodes::KEY_HOME }, { 2, KeyCodes::KEY_INSERT }, { 3, KeyCodes::KEY_DELETE },
+        { 4, KeyCodes::KEY_END }, { 5, KeyCodes::KEY_PAGE_UP }, { 6, KeyCodes::KEY_PAGE_DOWN },
+        { 7, KeyCodes::KEY_HOME }, { 8, KeyCodes::KEY_END }, { 10, KeyCodes::KEY_F0 },
+        { 11, KeyCodes::KEY_F1 }, { 12, KeyCodes::KEY_F2 }, { 13, KeyCodes::KEY_F3 },
+        { 14, KeyCodes::KEY_F4 }, { 15, KeyCodes::KEY_F5 }, { 17, KeyCodes::KEY_F6 },
+        { 18, KeyCodes::KEY_F7 }, { 19, KeyCodes::KEY_F8 }, { 20, KeyCodes::KEY_F9 },
+        { 21, KeyCodes::KEY_F10 }, { 23, KeyCodes::KEY_F11 }, { 24, KeyCodes::KEY_F12 } };
+
+    // Lookup table from code to key, zero where the code is not mapped
+    template<size_t N> constexpr std::array<int16_t, 128> make_key_table(
+        const KeyMapping (&mappings)[N])
+    {
+        std::array<int16_t, 128> table {};
+        for(const auto& m : mappings) {
+            table[m.code] = m.key;
+        }
+        return table;
+    }
+
+    constexpr std::array<uint8_t, 128> make_byte_class_table()
+    {
+        std::array<uint8_t, 128> table {};
+        for(int c=0; c<128; ++c) {
+            if(c >= '0' and c <= '9') {
+                table[c] = BC_DIGIT;
+            } else if(c == ';') {
+                table[c] = BC_SEPARATOR;
+            } else if((c >= 0x20 and c <= 0x2F) or (c >= 0x3A and c <= 0x3F)) {
+                table[c] = BC_INTERMEDIATE;
+            } else if(c >= 0x40 and c <= 0x7E) {
+                table[c] = BC_FINAL;
+            } else {
+                table[c] = BC_OTHER;
+            }
+        }
+        return table;
+    }
+
+    constexpr auto ss3_key_table = make_key_table(ss3_keys);
+    constexpr auto csi_key_table = make_key_table(csi_keys);
+    constexpr auto tilde_key_table = make_key_table(tilde_keys);
+    constexpr auto byte_class_table = make_byte_class_table();
+
+    constexpr int max_parameter_value = 65535;
+}
+
+void EscapeSequenceDecoder::start()
+{
+    clear();
+    push('\033');
+    state_ = DS_ESCAPE;
+}
+
+bool EscapeSequenceDecoder::push(int key)
+{
+    if(size_ == max_sequence_size) {
+        return false;
+    }
+    sequence_[size_++] = key;
+    return true;
+}
+
+int EscapeSequenceDecoder::decode(int key)
+{
+    if(not push(key)) {
+        return KeyCodes::UNSUPPORTED_ESCAPE_SEQUENCE;
+    }
+    unsigned code = std::min(unsigned(key), 127U);
+    switch(state_) {
+    case DS_ESCAPE:
+        if(key == '\033') {
+            return '\033';
+        } else if(key == '[') {
+            state_ = DS_CSI;
+            return KeyCodes::INCOMPLETE_ESCAPE_SEQUENCE;
+        } else if(key == 'O') {
+            state_ = DS_SS3;
+            return KeyCodes::INCOMPLETE_ESCAPE_SEQUENCE;
+        }
+        return KeyCodes::FAILED_ESCAPE_SEQUENCE;
+    case DS_SS3:
+        if(ss3_key_table[code]) {
+            return ss3_key_table[code];
+        }
+        return KeyCodes::UNSUPPORTED_ESCAPE_SEQUENCE;
+    case DS_CSI:
+        switch(byte_class_table[code]) {
+        case BC_DIGIT:
+            if(nparam_ == 0) {
+                param_[nparam_++] = 0;
+            }
+            if(nparam_ <= max_parameters) {
+                param_[nparam_-1] = std::min(param_[nparam_-1]*10 + (key-'0'),
+                    max_parameter_value);
+            }
+            return KeyCodes::INCOMPLETE_ESCAPE_SEQUENCE;
+        case BC_SEPARATOR:
+            if(nparam_ == 0) {
+                param_[nparam_++] = 0;
+            }
+            if(++nparam_ <= max_parameters) {
+                param_[nparam_-1] = 0;
+            }
+            return KeyCodes::INCOMPLETE_ESCAPE_SEQUENCE;
+        case BC_INTERMEDIATE:
+            return KeyCodes::INCOMPLETE_ESCAPE_SEQUENCE;
+        case BC_FINAL:
+            if(key == '~') {
+                if(nparam_ == 1 and param_[0] < int(tilde_key_table.size())
+                        and tilde_key_table[param_[0]]) {
+                    return tilde_key_table[param_[0]];
+                }
+            } else if(csi_key_table[code]) {
+                return csi_key_table[code];
+            }
+            return KeyCodes::UNSUPPORTED_ESCAPE_SEQUENCE;
+        default:
+            return KeyCodes::FAILED_ESCAPE_SEQUENCE;
+        }
+    default:
+        return KeyCodes::FAILED_ESCAPE_SEQUENCE;
+    }
+}
+
+const std::vector<std::string>& EscapeSequenceDecoder::parameter_strings()
+{
+    if(nparam_ == 0) {
+        return no_parameters();
+    }
+    parameter_strings_.clear();
+    for(unsigned i=0; i<std::min(nparam_, max_parameters); ++i) {
+        parameter_strings_.push_back(std::to_string(param_[i]));
+    }
+    return parameter_strings_;
+}
+
+const std::vector<std::string>& EscapeSequenceDecoder::no_parameters()
+{
+    static const std::vector<std::string> empty;
+    return empty;
+}
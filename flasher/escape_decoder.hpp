@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Decoder for the escape sequences sent by terminals for cursor keys,
+// function keys and cursor position reports. Bytes are fed in one at a time
+// after the initial ESC, and each is classified and mapped to a key through
+// tables built at compile time. The sequence and its numeric parameters are
+// held in fixed-size buffers, so decoding a key never touches the heap.
+class EscapeSequenceDecoder {
+public:
+    static constexpr unsigned max_sequence_size = 16;
+    static constexpr unsigned max_parameters = 4;
+
+    bool active() const { return size_ != 0; }
+    void start();
+    void clear() { size_ = 0; state_ = DS_IDLE; nparam_ = 0; }
+
+    // Returns the key, or one of KeyCodes::INCOMPLETE_ESCAPE_SEQUENCE,
+    // KeyCodes::FAILED_ESCAPE_SEQUENCE or KeyCodes::UNSUPPORTED_ESCAPE_SEQUENCE.
+    // On failure the bytes should be processed as ordinary keys.
+    int decode(int key);
+
+    const char* sequence() const { return sequence_; }
+    unsigned size() const { return size_; }
+    unsigned num_parameters() const { return nparam_; }
+    int parameter(unsigned i) const {
+        return (i<nparam_ and i<max_parameters) ? param_[i] : 0; }
+
+    // The parameters as strings, for Menu::process_key_press. Only
+    // sequences that carry parameters allocate, which excludes the keys.
+    const std::vector<std::string>& parameter_strings();
+    static const std::vector<std::string>& no_parameters();
+
+private:
+    enum DecoderState { DS_IDLE, DS_ESCAPE, DS_SS3, DS_CSI };
+
+    bool push(int key);
+
+    DecoderState state_ = DS_IDLE;
+    char sequence_[max_sequence_size];
+    unsigned size_ = 0;
+    int param_[max_parameters];
+    unsigned nparam_ = 0;
+    std::vector<std::string> parameter_strings_;
+};
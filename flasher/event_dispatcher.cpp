@@ -1,65 +1,650 @@
 #include <cstdlib>
+#include <algorithm>
 
 #include <pico/stdlib.h>
 #include <pico/multicore.h>
+#include <pico/flash.h>
+#include <hardware/dma.h>
+#include <hardware/clocks.h>
+#include <hardware/timer.h>
+#include <hardware/irq.h>
+#include <hardware/sync.h>
 
+#include "flasher.hpp"
 #include "build_date.hpp"
+#include "menu.hpp"
 #include "event_dispatcher.hpp"
+#include "trigger_generator.hpp"
 #include "set_charges.pio.h"
 
 namespace {
     static BuildDate build_date(__DATE__,__TIME__);
+
+    void load_scratch_register(PIO pio, uint sm, enum pio_src_dest dest, uint32_t value)
+    {
+        // Pass the value through the TX FIFO and OSR, the state machine must
+        // be stopped with an empty FIFO
+        pio_sm_put(pio, sm, value);
+        pio_sm_exec(pio, sm, pio_encode_pull(false, false));
+        if(dest != pio_osr) {
+            pio_sm_exec(pio, sm, pio_encode_mov(dest, pio_osr));
+        }
+    }
 }
 
 EventDispatcher::EventDispatcher()
 {
-    mutex_init(&mutex_);
+    // nothing to see here
 }
 
 void EventDispatcher::launch_dispatcher_thread()
 {
+    // Let core0 pause this core while it writes settings to the flash
+    flash_safe_execute_core_init();
     instance().run_dispatcher_loop();
+    flash_safe_execute_core_deinit();
 }
 
 void EventDispatcher::run_dispatcher_loop()
 {
-    uint32_t x[128];
-
     // Choose which PIO instance to use (there are two instances)
-    PIO pio = pio0;
+    pio_ = pio0;
 
     // Our assembled program needs to be loaded into this PIO's instruction
     // memory. This SDK function will find a location (offset) in the
     // instruction memory where there is enough space for our program. We need
     // to remember this location!
-    uint offset = pio_add_program(pio, &set_charges_program);
+    pio_offset_ = pio_add_program(pio_, &set_charges_program);
 
     // Find a free state machine on our chosen PIO (erroring if there are
     // none). Configure it to run our program, and start it, using the
     // helper function we included in our .pio file.
-    uint sm = pio_claim_unused_sm(pio, true);
-    set_charges_program_init(pio, sm, offset, 0, 20);
+    sm_ = pio_claim_unused_sm(pio_, true);
+    set_charges_program_init(pio_, sm_, pio_offset_, VDAC_BASE_PIN, DAC_EN_PIN, DAC_WR_PIN);
+    trigger_pio_offset_ = pio_add_program(pio_, &trigger_follow_program);
+    trigger_sm_ = pio_claim_unused_sm(pio_, true);
+    trigger_follow_program_init(pio_, trigger_sm_, trigger_pio_offset_, TRIG_PIN);
+    cycles_per_us_ = clock_get_hz(clk_sys) / 1000000;
 
-    bool state = 0;
-    lock();
+    // Interrupts exist only to wake core1 from __wfe when the state machine
+    // or DMA needs attention, so they are handled on this core
+    irq_set_exclusive_handler(DMA_IRQ_1, &EventDispatcher::dma_irq_handler);
+    irq_set_enabled(DMA_IRQ_1, true);
+    irq_set_exclusive_handler(PIO0_IRQ_1, &EventDispatcher::pio_irq_handler);
+    irq_set_enabled(PIO0_IRQ_1, true);
+
+    reset_timeline();
     while(run_dispatcher_) {
         dispatcher_running_ = true;
-        if(generator_ and generator_->isEnabled()) {
-            uint32_t delay = generator_->nextEventDelay();
-            uint32_t nx = generator_->nextEventPattern(x);
-            unlock();
-            gpio_put(PICO_DEFAULT_LED_PIN, state);
-            state = 1 - state;
-            pio_sm_put_blocking(pio, sm, x[0]);
-            sleep_us(delay);
+        if(streaming_) {
+            run_streaming_loop();
         } else {
-            unlock();
-            sleep_us(100);            
+            run_direct_loop();
         }
-        lock();
+        // Stopped, switched mode or reconfigured, start again from scratch
+        reconfigure_ = false;
+        reset_timeline();
+    }
+
+    irq_set_enabled(PIO0_IRQ_1, false);
+    irq_remove_handler(PIO0_IRQ_1, &EventDispatcher::pio_irq_handler);
+    irq_set_enabled(DMA_IRQ_1, false);
+    irq_remove_handler(DMA_IRQ_1, &EventDispatcher::dma_irq_handler);
+    pio_sm_set_enabled(pio_, trigger_sm_, false);
+    if(gpio_get_function(TRIG_PIN) == GPIO_FUNC_PIO0) {
+        gpio_put(TRIG_PIN, 0);
+        gpio_set_function(TRIG_PIN, GPIO_FUNC_SIO);
     }
     dispatcher_running_ = false;
-    unlock();
+}
+
+void EventDispatcher::dma_irq_handler()
+{
+    // DMA_IRQ_1 ends the __wfe in the streaming loop, and keeps a note of
+    // the channels that have finished so the loop can tell whether a half
+    // was started by the chain
+    uint32_t ints = dma_hw->ints1;
+    instance().dma_done_mask_ |= ints;
+    dma_hw->ints1 = ints;
+}
+
+void EventDispatcher::pio_irq_handler()
+{
+    // The TX FIFO not full interrupt stays asserted while there is space, so
+    // it is a one-shot that core1 enables each time it waits for space
+    EventDispatcher& dispatcher = instance();
+    pio_set_irq1_source_enabled(dispatcher.pio_,
+        pio_interrupt_source(pis_sm0_tx_fifo_not_full + dispatcher.sm_), false);
+}
+
+void EventDispatcher::restart_state_machine()
+{
+    // Throw away anything queued for the state machine and send it back to
+    // the start of the program with an empty OSR, ready for the next record
+    pio_sm_set_enabled(pio_, sm_, false);
+    pio_sm_clear_fifos(pio_, sm_);
+    pio_sm_restart(pio_, sm_);
+    restart_trigger_state_machine();
+    load_scratch_register(pio_, sm_, pio_isr, trigger_lead_cycles_);
+    pio_sm_exec(pio_, sm_, pio_encode_mov(pio_osr, pio_null));
+    pio_sm_exec(pio_, sm_, pio_encode_out(pio_null, 32));
+    pio_sm_exec(pio_, sm_, pio_encode_jmp(pio_offset_ + set_charges_offset_start));
+    pio_sm_set_enabled(pio_, sm_, true);
+
+    // Any SCALE write still queued has been thrown away, so the next event
+    // that asks for a SCALE must write it
+    current_scale_ = -1;
+    pending_scale_write_ = pending_record_ and pending_event_scale_ >= 0;
+}
+
+void EventDispatcher::restart_trigger_state_machine()
+{
+    // Take the trigger settings from core0. A lead of A cycles in the
+    // set_charges records puts the strobe SET_CHARGES_IRQ_TO_STROBE+A
+    // cycles after the IRQ, so the follower must wait offset+A more than
+    // that before raising TRIG_PIN. It is back waiting for the IRQ one
+    // cycle after the end of the pulse, and the next IRQ must not come
+    // before that, so triggered strobes must be at least the spacing apart.
+    trigger_active_ = trigger_enabled_;
+    trigger_active_every_nth_ = std::max(trigger_every_nth_.load(), 1U);
+    trigger_count_ = 0;
+    pending_trigger_ = false;
+    int32_t offset_cycles = trigger_offset_cycles_;
+    uint32_t pulse_cycles = std::max<uint32_t>(trigger_width_cycles_, TRIGGER_FOLLOW_WIDTH_OVERHEAD);
+    trigger_lead_cycles_ = trigger_active_ ? std::max(-offset_cycles, 0) : 0;
+    trigger_spacing_cycles_ = std::max(offset_cycles, 0) + pulse_cycles
+        + SET_CHARGES_IRQ_TO_STROBE + 1;
+    trigger_ready_cycles_ = 0;
+    uint32_t delay_cycles = offset_cycles + int32_t(trigger_lead_cycles_)
+        + SET_CHARGES_IRQ_TO_STROBE - TRIGGER_FOLLOW_DELAY_OVERHEAD;
+    uint32_t width_cycles = pulse_cycles - TRIGGER_FOLLOW_WIDTH_OVERHEAD;
+
+    pio_sm_set_enabled(pio_, trigger_sm_, false);
+    pio_sm_clear_fifos(pio_, trigger_sm_);
+    pio_sm_restart(pio_, trigger_sm_);
+    pio_interrupt_clear(pio_, 4);
+    pio_sm_exec(pio_, trigger_sm_, pio_encode_set(pio_pins, 0));
+    load_scratch_register(pio_, trigger_sm_, pio_isr, delay_cycles);
+    load_scratch_register(pio_, trigger_sm_, pio_osr, width_cycles);
+    pio_sm_exec(pio_, trigger_sm_, pio_encode_jmp(trigger_pio_offset_));
+    pio_sm_set_enabled(pio_, trigger_sm_, true);
+
+    if(trigger_active_) {
+        pio_gpio_init(pio_, TRIG_PIN);
+    } else if(gpio_get_function(TRIG_PIN) == GPIO_FUNC_PIO0) {
+        // Hand the pin back if we have it
+        gpio_put(TRIG_PIN, 0);
+        gpio_set_function(TRIG_PIN, GPIO_FUNC_SIO);
+    }
+}
+
+int EventDispatcher::event_scale(uint32_t pattern)
+{
+    // SCALE setting asked for by an event, or -1 for whatever is set
+    if(pattern & EventGenerator::scale_flag()) {
+        return (pattern >> 16) & 0xFF;
+    }
+    return -1;
+}
+
+bool EventDispatcher::count_triggered_event(uint32_t pattern)
+{
+    // Count the flashes, returning true for every Nth
+    if(not trigger_active_ or (pattern & 0xFFFF) == 0) {
+        return false;
+    }
+    if(++trigger_count_ < trigger_active_every_nth_) {
+        return false;
+    }
+    trigger_count_ = 0;
+    return true;
+}
+
+void EventDispatcher::run_direct_loop()
+{
+    bool state = 0;
+    while(not reconfigure_) {
+        uint32_t delay_word;
+        uint32_t pattern_word;
+        if(pio_sm_is_tx_fifo_empty(pio_, sm_)) {
+            // We may have fallen behind the state machine
+            catch_up_timeline();
+        }
+        if(next_record(delay_word, pattern_word)) {
+            if(not wait_for_tx_fifo_space()) { break; }
+            pio_sm_put(pio_, sm_, delay_word);
+            if(not wait_for_tx_fifo_space()) { break; }
+            pio_sm_put(pio_, sm_, pattern_word);
+            if(pattern_word) {
+                gpio_put(PICO_DEFAULT_LED_PIN, state);
+                state = 1 - state;
+            }
+        } else {
+            // The generator rings the doorbell when it is enabled again, the
+            // timeout is only a backstop for generators that do not
+            best_effort_wfe_or_timeout(make_timeout_time_us(idle_wake_us()));
+            idle_timeline(timeline_now_cycles());
+        }
+    }
+}
+
+bool EventDispatcher::wait_for_tx_fifo_space()
+{
+    // Sleep until the state machine takes a word from the TX FIFO. Returns
+    // false if the doorbell was rung while waiting.
+    while(pio_sm_is_tx_fifo_full(pio_, sm_)) {
+        if(reconfigure_) {
+            return false;
+        }
+        pio_set_irq1_source_enabled(pio_,
+            pio_interrupt_source(pis_sm0_tx_fifo_not_full + sm_), true);
+        __wfe();
+    }
+    return not reconfigure_;
+}
+
+void EventDispatcher::run_streaming_loop()
+{
+    // Two DMA channels drain the halves of the ring into the TX FIFO in turn,
+    // at the pace set by the state machine. While one half is being sent the
+    // other is refilled. A channel is only chained to the other once the
+    // other's half has been filled, so if core1 falls behind the stream
+    // stalls rather than replaying old records. Core1 then starts the half
+    // itself as soon as it is ready, the slip of the timeline is made up by
+    // the events that follow and the events of the half are counted late.
+    uint chan[2];
+    dma_channel_config config[2];
+    unsigned nflash[2];
+    for(unsigned i=0; i<2; ++i) {
+        chan[i] = dma_claim_unused_channel(true);
+    }
+    for(unsigned i=0; i<2; ++i) {
+        config[i] = dma_channel_get_default_config(chan[i]);
+        channel_config_set_transfer_data_size(&config[i], DMA_SIZE_32);
+        channel_config_set_read_increment(&config[i], true);
+        channel_config_set_write_increment(&config[i], false);
+        channel_config_set_dreq(&config[i], pio_get_dreq(pio_, sm_, true));
+        channel_config_set_chain_to(&config[i], chan[i]);
+        dma_channel_configure(chan[i], &config[i], &pio_->txf[sm_],
+            stream_buffer_[i], fill_stream_buffer(stream_buffer_[i], nflash[i]), false);
+        dma_channel_set_irq1_enabled(chan[i], true);
+    }
+    channel_config_set_chain_to(&config[0], chan[1]);
+    dma_channel_set_config(chan[0], &config[0], false);
+    dma_channel_start(chan[0]);
+
+    bool state = 0;
+    unsigned ibuffer = 0;
+    while(not reconfigure_) {
+        // Sleep until a channel finishes or the doorbell is rung
+        while(dma_channel_is_busy(chan[ibuffer]) and not reconfigure_) {
+            __wfe();
+        }
+        if(reconfigure_) {
+            break;
+        }
+
+        // The other half is being sent, or has been already. Refill this
+        // one, without a chain, before letting the other chain to it.
+        uint32_t done_mask = 1u << chan[ibuffer];
+        uint32_t interrupts = save_and_disable_interrupts();
+        dma_channel_acknowledge_irq1(chan[ibuffer]);
+        dma_done_mask_ &= ~done_mask;
+        restore_interrupts(interrupts);
+        uint64_t start_cycles = sent_cycles_;
+        unsigned nword = fill_stream_buffer(stream_buffer_[ibuffer], nflash[ibuffer]);
+        channel_config_set_chain_to(&config[ibuffer], chan[ibuffer]);
+        dma_channel_set_config(chan[ibuffer], &config[ibuffer], false);
+        dma_channel_set_read_addr(chan[ibuffer], stream_buffer_[ibuffer], false);
+        dma_channel_set_trans_count(chan[ibuffer], nword, false);
+        channel_config_set_chain_to(&config[1-ibuffer], chan[ibuffer]);
+        dma_channel_set_config(chan[1-ibuffer], &config[1-ibuffer], false);
+        // The chain starts this channel as the other finishes, so once the
+        // other is idle this one has been started if it is busy or has
+        // finished already. The raw status is read before the mask, so a
+        // completion is seen whether or not the handler has taken it yet.
+        if(not dma_channel_is_busy(chan[1-ibuffer]) and not dma_channel_is_busy(chan[ibuffer])
+                and not (dma_hw->intr & done_mask) and not (dma_done_mask_ & done_mask)) {
+            // The other half finished before the chain was set, so this one
+            // goes out late. Anything left in the FIFO may cover some of it.
+            uint64_t now_cycles = timeline_now_cycles();
+            if(now_cycles > start_cycles) {
+                record_late_event(now_cycles - start_cycles, nflash[ibuffer]);
+                sent_cycles_ += now_cycles - start_cycles;
+            }
+            dma_channel_start(chan[ibuffer]);
+        }
+        gpio_put(PICO_DEFAULT_LED_PIN, state);
+        state = 1 - state;
+        ibuffer = 1 - ibuffer;
+    }
+
+    // Break the chain before aborting, otherwise aborting one channel can
+    // trigger the other
+    for(unsigned i=0; i<2; ++i) {
+        channel_config_set_chain_to(&config[i], chan[i]);
+        dma_channel_set_config(chan[i], &config[i], false);
+    }
+    for(unsigned i=0; i<2; ++i) {
+        dma_channel_set_irq1_enabled(chan[i], false);
+        dma_channel_abort(chan[i]);
+        dma_channel_acknowledge_irq1(chan[i]);
+        dma_channel_unclaim(chan[i]);
+    }
+}
+
+unsigned EventDispatcher::fill_stream_buffer(uint32_t* buffer, unsigned& nflash)
+{
+    // Fill with records until the buffer is full or it holds enough time that
+    // there is no point in looking further ahead. Returns the number of words
+    // written, and the number of flashes they carry.
+    const uint64_t horizon_cycles = uint64_t(stream_horizon_us()) * cycles_per_us_;
+    uint64_t buffer_cycles = 0;
+    unsigned iword = 0;
+    uint32_t sent_flashes = sent_flashes_;
+    while(iword+2 <= stream_buffer_words and buffer_cycles < horizon_cycles) {
+        uint64_t record_cycles = next_record(buffer[iword], buffer[iword+1]);
+        if(record_cycles == 0) {
+            // Generator is disabled, idle without flashing
+            record_cycles = uint64_t(idle_record_us()) * cycles_per_us_;
+            buffer[iword] = set_charges_delay_word(pio_offset_, set_charges_offset_delay_loop,
+                record_cycles - SET_CHARGES_DELAY_OVERHEAD);
+            buffer[iword+1] = 0;
+            idle_timeline(sent_cycles_ + record_cycles);
+        }
+        buffer_cycles += record_cycles;
+        iword += 2;
+        if(pipeline_starved_) {
+            // Send what we have rather than filling with empty records
+            break;
+        }
+    }
+    nflash = sent_flashes_ - sent_flashes;
+    return iword;
+}
+
+uint64_t EventDispatcher::next_record(uint32_t& delay_word, uint32_t& pattern_word)
+{
+    // Returns one (delay, patterns) record for the set_charges state machine,
+    // taking the next event from the current block if necessary, and the
+    // number of cycles the record lasts, or zero if there is no event to
+    // send. Delays too long for one record are sent as several with empty
+    // patterns, the last carrying the event. Records of triggered events
+    // also carry the lead window and the IRQ that starts the trigger. Events
+    // that need another SCALE setting are preceded by a DAC record.
+    static const uint64_t max_record_cycles = uint64_t(SET_CHARGES_MAX_DELAY) + SET_CHARGES_DELAY_OVERHEAD;
+    const uint64_t min_triggered_record_cycles = uint64_t(SET_CHARGES_DELAY_OVERHEAD)
+        + SET_CHARGES_TRIGGER_EXTRA_CYCLES + trigger_lead_cycles_;
+    uint64_t min_record_cycles = SET_CHARGES_DELAY_OVERHEAD;
+    if(not pending_record_) {
+        if(event_block_ievent_ == event_block_nevent_ or event_block_generator_ != generator_) {
+            if(pipeline_) {
+                if(not next_pipeline_block()) {
+                    // Core0 has fallen behind. Wait a little with an empty
+                    // record, keeping our place on the timeline so that any
+                    // events made late by this are counted.
+                    uint64_t record_cycles = uint64_t(pipeline_wait_us()) * cycles_per_us_;
+                    sent_cycles_ += record_cycles;
+                    delay_word = set_charges_delay_word(pio_offset_, set_charges_offset_delay_loop,
+                        record_cycles - SET_CHARGES_DELAY_OVERHEAD);
+                    pattern_word = 0;
+                    return record_cycles;
+                }
+            } else {
+                // Virtual dispatch and the generator handshake are paid here,
+                // once per block, rather than for every event
+                event_block_generator_ = acquire_generator();
+                if(pipeline_) {
+                    // Switched to pipeline mode since we looked, core0 may
+                    // already be using the generator
+                    event_block_generator_ = nullptr;
+                }
+                event_block_nevent_ = event_block_generator_ ?
+                    event_block_generator_->nextEvents(event_block_, event_block_size,
+                        stream_horizon_us()) : 0;
+                event_block_events_ = event_block_;
+                event_block_ievent_ = 0;
+                release_generator();
+            }
+            if(event_block_nevent_ == 0) {
+                return 0;
+            }
+        }
+        const EventGenerator::Event& event = event_block_events_[event_block_ievent_++];
+        pending_trigger_ = count_triggered_event(event.pattern);
+        if(pending_trigger_) {
+            min_record_cycles = min_triggered_record_cycles;
+        }
+        pending_event_scale_ = event_scale(event.pattern);
+        pending_scale_write_ = pending_event_scale_ >= 0 and pending_event_scale_ != current_scale_;
+        if(pending_scale_write_) {
+            min_record_cycles += SET_CHARGES_DAC_WRITE_OVERHEAD;
+        }
+
+        // Records are cut at the rounded deadline of each event, so the
+        // rounding errors never add up. The nominal timeline is where the
+        // records would have been had the state machine never been starved,
+        // any event sent later than that is late.
+        timeline_cycles_q16_ += event.delay_us_q16 * cycles_per_us_;
+        uint64_t deadline_cycles = (timeline_cycles_q16_ + 0x8000) >> 16;
+        nominal_cycles_ = std::max(deadline_cycles, nominal_cycles_ + min_record_cycles);
+        uint64_t earliest_cycles = sent_cycles_ + min_record_cycles;
+        if(pending_trigger_) {
+            // The follower must have finished the previous pulse, so a
+            // trigger that comes too soon after it is pushed back, and is
+            // counted as late
+            earliest_cycles = std::max(earliest_cycles, trigger_ready_cycles_);
+        }
+        pending_delay_cycles_ = std::max(deadline_cycles, earliest_cycles) - sent_cycles_;
+        sent_cycles_ += pending_delay_cycles_;
+        if(sent_cycles_ > nominal_cycles_) {
+            record_late_event(sent_cycles_ - nominal_cycles_);
+        }
+        pending_pattern_ = event.pattern & 0xFFFF;
+        pending_record_ = true;
+
+        // The record has room for a second pattern, strobed a few cycles
+        // after the first. Use it for the next event if that is due before
+        // a record of its own could fire it, as in a burst of LEDs. An event
+        // that should be triggered is left for a record of its own, unless
+        // this one is triggered already.
+        if(event_block_ievent_ < event_block_nevent_) {
+            const EventGenerator::Event& next_event = event_block_events_[event_block_ievent_];
+            uint64_t next_timeline_cycles_q16 =
+                timeline_cycles_q16_ + next_event.delay_us_q16 * cycles_per_us_;
+            uint64_t next_deadline_cycles = (next_timeline_cycles_q16 + 0x8000) >> 16;
+            bool next_triggered = trigger_active_ and (next_event.pattern & 0xFFFF)
+                and trigger_count_+1 >= trigger_active_every_nth_;
+            int next_scale = event_scale(next_event.pattern);
+            int scale = pending_event_scale_ >= 0 ? pending_event_scale_ : current_scale_;
+            if(next_deadline_cycles < sent_cycles_ + SET_CHARGES_DELAY_OVERHEAD
+                    and (pending_trigger_ or not next_triggered)
+                    and (next_scale < 0 or next_scale == scale)) {
+                count_triggered_event(next_event.pattern);
+                timeline_cycles_q16_ = next_timeline_cycles_q16;
+                uint64_t nominal_second_cycles = std::max(next_deadline_cycles,
+                    nominal_cycles_ + SET_CHARGES_SECOND_PATTERN_OFFSET);
+                uint64_t second_cycles = sent_cycles_ + SET_CHARGES_SECOND_PATTERN_OFFSET;
+                if(second_cycles > nominal_second_cycles) {
+                    record_late_event(second_cycles - nominal_second_cycles);
+                }
+                pending_pattern_ |= (next_event.pattern & 0xFFFF) << 16;
+                ++event_block_ievent_;
+            }
+        }
+    }
+    // Split long delays so that the last record, which carries the event, is
+    // never shorter than the minimum
+    uint64_t last_min_cycles =
+        pending_trigger_ ? min_triggered_record_cycles : uint64_t(SET_CHARGES_DELAY_OVERHEAD);
+    if(pending_scale_write_) {
+        // Write the SCALE DAC straight after the previous event, leaving it
+        // as long as possible to settle. After a restart there may not be
+        // room for it, in which case the event goes a little later.
+        uint64_t needed_cycles = SET_CHARGES_DAC_WRITE_OVERHEAD + last_min_cycles;
+        if(pending_delay_cycles_ < needed_cycles) {
+            sent_cycles_ += needed_cycles - pending_delay_cycles_;
+            pending_delay_cycles_ = needed_cycles;
+        }
+        pending_delay_cycles_ -= SET_CHARGES_DAC_WRITE_OVERHEAD;
+        pending_scale_write_ = false;
+        current_scale_ = pending_event_scale_;
+        delay_word = set_charges_delay_word(pio_offset_, set_charges_offset_dac_loop, 0);
+        pattern_word = pending_event_scale_;
+        return SET_CHARGES_DAC_WRITE_OVERHEAD;
+    }
+    uint64_t record_cycles = pending_delay_cycles_;
+    if(record_cycles > max_record_cycles) {
+        record_cycles = std::min(max_record_cycles, pending_delay_cycles_ - last_min_cycles);
+    }
+    pending_delay_cycles_ -= record_cycles;
+    if(pending_delay_cycles_ == 0) {
+        if(pending_trigger_) {
+            delay_word = set_charges_delay_word(pio_offset_, set_charges_offset_trigger_loop,
+                record_cycles - last_min_cycles);
+            trigger_ready_cycles_ = sent_cycles_ + trigger_spacing_cycles_;
+        } else {
+            delay_word = set_charges_delay_word(pio_offset_, set_charges_offset_delay_loop,
+                record_cycles - SET_CHARGES_DELAY_OVERHEAD);
+        }
+        pattern_word = pending_pattern_;
+        sent_flashes_ += bool(pending_pattern_ & 0xFFFF) + bool(pending_pattern_ >> 16);
+        pending_record_ = false;
+        pending_trigger_ = false;
+    } else {
+        delay_word = set_charges_delay_word(pio_offset_, set_charges_offset_delay_loop,
+            record_cycles - SET_CHARGES_DELAY_OVERHEAD);
+        pattern_word = 0;
+    }
+    return record_cycles;
+}
+
+bool EventDispatcher::next_pipeline_block()
+{
+    // Hand back the slot of the block we have finished with, and take the
+    // next block made by the registered generator, dropping any left over
+    // from a previous one. Returns false if the queue is empty.
+    if(pipeline_block_held_) {
+        pipeline_queue_.pop();
+        pipeline_block_held_ = false;
+    }
+    EventGenerator* generator = generator_;
+    while(const EventBlock* block = pipeline_queue_.front()) {
+        if(block->generator == generator) {
+            event_block_generator_ = generator;
+            event_block_events_ = block->events;
+            event_block_nevent_ = block->nevent;
+            event_block_ievent_ = 0;
+            pipeline_block_held_ = true;
+            pipeline_starved_ = false;
+            return true;
+        }
+        pipeline_queue_.pop();
+    }
+    pipeline_starved_ = true;
+    return false;
+}
+
+void EventDispatcher::run_pipeline_producer()
+{
+    // Runs on core0. Fill the queue, within a time budget so the menu stays
+    // responsive. A disabled generator, or none, is passed on as an empty
+    // block so that core1 can tell it apart from core0 falling behind.
+    if(not pipeline_ or not dispatcher_running_) {
+        return;
+    }
+    absolute_time_t budget_end = make_timeout_time_us(pipeline_producer_budget_us());
+    EventGenerator* generator = generator_;
+    bool pushed = false;
+    while(EventBlock* block = pipeline_queue_.free_slot()) {
+        block->generator = generator;
+        block->nevent = generator ?
+            generator->nextEvents(block->events, event_block_size, stream_horizon_us()) : 0;
+        pipeline_queue_.push();
+        pushed = true;
+        if(block->nevent == 0 or time_reached(budget_end)) {
+            break;
+        }
+    }
+    if(pushed) {
+        // Wake core1 if it is idle
+        __sev();
+    }
+}
+
+void EventDispatcher::pipeline_background_task()
+{
+    instance().run_pipeline_producer();
+}
+
+uint64_t EventDispatcher::timeline_now_cycles()
+{
+    return (time_us_64() - timeline_origin_us_) * cycles_per_us_;
+}
+
+void EventDispatcher::reset_timeline()
+{
+    restart_state_machine();
+    timeline_origin_us_ = time_us_64();
+    timeline_cycles_q16_ = 0;
+    sent_cycles_ = 0;
+    nominal_cycles_ = 0;
+    pending_record_ = false;
+    event_block_nevent_ = event_block_ievent_ = 0;
+    event_block_events_ = event_block_;
+    pipeline_queue_.clear();
+    pipeline_block_held_ = false;
+    pipeline_starved_ = false;
+}
+
+void EventDispatcher::catch_up_timeline()
+{
+    // The state machine cannot have got to the end of the records we sent
+    // before now, so if it is later than that it has been waiting for us
+    sent_cycles_ = std::max(sent_cycles_, timeline_now_cycles());
+}
+
+void EventDispatcher::idle_timeline(uint64_t cycles)
+{
+    // No events while the generator is disabled, so when it comes back the
+    // timeline starts again from wherever the state machine has got to
+    sent_cycles_ = nominal_cycles_ = std::max(sent_cycles_, cycles);
+    timeline_cycles_q16_ = sent_cycles_ << 16;
+}
+
+void EventDispatcher::record_late_event(uint64_t lateness_cycles, unsigned nevent)
+{
+    // Only core1 writes the statistics, core0 asks for them to be reset
+    if(reset_late_event_statistics_) {
+        reset_late_event_statistics_ = false;
+        late_event_count_ = 0;
+        max_lateness_us_ = 0;
+    }
+    uint32_t lateness_us = std::min(lateness_cycles / cycles_per_us_, uint64_t(0xFFFFFFFFU));
+    late_event_count_ = late_event_count_ + nevent;
+    if(lateness_us > max_lateness_us_) {
+        max_lateness_us_ = lateness_us;
+    }
+}
+
+EventGenerator* EventDispatcher::acquire_generator()
+{
+    // Announce which generator core1 is about to use before checking that it
+    // is still the registered one, so core0 can wait until it is released
+    EventGenerator* generator = generator_.load();
+    while(true) {
+        generator_in_use_.store(generator);
+        EventGenerator* registered_generator = generator_.load();
+        if(registered_generator == generator) {
+            return generator;
+        }
+        generator = registered_generator;
+    }
+}
+
+void EventDispatcher::release_generator()
+{
+    generator_in_use_.store(nullptr);
 }
 
 void EventDispatcher::start_dispatcher()
@@ -70,29 +655,128 @@ void EventDispatcher::start_dispatcher()
 
 void EventDispatcher::stop_dispatcher()
 {
-    lock();
     run_dispatcher_ = false;
-    unlock();  
+    notify_dispatcher();
 }
 
 bool EventDispatcher::is_dispatcher_running()
 {
-    lock();
-    bool running = dispatcher_running_;
-    unlock();
-    return running;
+    return dispatcher_running_;
 }
 
 void EventDispatcher::clear_event_generator()
 {
-    lock();
-    generator_ = nullptr;
-    unlock();
+    register_event_generator(nullptr);
 }
 
 void EventDispatcher::register_event_generator(EventGenerator* generator)
 {
-    lock();
-    generator_ = generator;
-    unlock();
+    EventGenerator* old_generator = generator_.load();
+    generator_.store(generator);
+    while(old_generator != nullptr and old_generator != generator
+            and generator_in_use_.load() == old_generator) {
+        tight_loop_contents();
+    }
+    notify_dispatcher();
+}
+
+void EventDispatcher::notify_dispatcher()
+{
+    reconfigure_ = true;
+    __sev();
+}
+
+void EventDispatcher::set_streaming_mode(bool streaming)
+{
+    if(streaming != streaming_) {
+        streaming_ = streaming;
+        notify_dispatcher();
+    }
+}
+
+bool EventDispatcher::is_streaming_mode()
+{
+    return streaming_;
+}
+
+void EventDispatcher::set_pipeline_mode(bool pipeline)
+{
+    if(pipeline != pipeline_) {
+        pipeline_ = pipeline;
+        // Core1 may be part way through a block, the generator must not be
+        // called from both cores at once
+        while(generator_in_use_.load() != nullptr) {
+            tight_loop_contents();
+        }
+        if(pipeline) {
+            Menu::set_background_task(&EventDispatcher::pipeline_background_task,
+                pipeline_task_interval_us());
+        } else {
+            Menu::clear_background_task();
+        }
+        notify_dispatcher();
+    }
+}
+
+bool EventDispatcher::is_pipeline_mode()
+{
+    return pipeline_;
+}
+
+bool EventDispatcher::set_event_trigger(unsigned every_nth, int32_t offset_cycles, uint32_t width_cycles)
+{
+    if(TriggerGenerator::instance().is_running()) {
+        return false;
+    }
+    offset_cycles = std::clamp(offset_cycles,
+        -max_event_trigger_offset_cycles(), max_event_trigger_offset_cycles());
+    trigger_every_nth_ = std::max(every_nth, 1U);
+    trigger_offset_cycles_ = offset_cycles;
+    trigger_width_cycles_ = width_cycles;
+    trigger_enabled_ = true;
+    notify_dispatcher();
+    return true;
+}
+
+void EventDispatcher::disable_event_trigger()
+{
+    if(trigger_enabled_) {
+        trigger_enabled_ = false;
+        notify_dispatcher();
+    }
+}
+
+bool EventDispatcher::is_event_trigger_enabled()
+{
+    return trigger_enabled_;
+}
+
+unsigned EventDispatcher::event_trigger_every_nth()
+{
+    return trigger_every_nth_;
+}
+
+int32_t EventDispatcher::event_trigger_offset_cycles()
+{
+    return trigger_offset_cycles_;
+}
+
+uint32_t EventDispatcher::event_trigger_width_cycles()
+{
+    return trigger_width_cycles_;
+}
+
+uint32_t EventDispatcher::late_event_count()
+{
+    return reset_late_event_statistics_ ? 0 : late_event_count_.load();
+}
+
+uint32_t EventDispatcher::max_lateness_us()
+{
+    return reset_late_event_statistics_ ? 0 : max_lateness_us_.load();
+}
+
+void EventDispatcher::reset_late_event_statistics()
+{
+    reset_late_event_statistics_ = true;
 }
@@ -1,8 +1,11 @@
 #pragma once
 
-#include<pico/sync.h>
+#include<atomic>
+
+#include<hardware/pio.h>
 
 #include"event_generators.hpp"
+#include"spsc_queue.hpp"
 
 class EventDispatcher
 {
@@ -11,27 +14,177 @@ public:
     void stop_dispatcher();
     bool is_dispatcher_running();
 
-    void lock() { mutex_enter_blocking(&mutex_); }
-    void unlock() { mutex_exit(&mutex_); };
-
+    // The dispatcher and the menu core never lock each other out. Generator
+    // parameters are handed over by the generators themselves (see SeqLock),
+    // and the dispatcher state is held in atomics. Replacing the generator
+    // waits until core1 has finished any event it is taking from the old one,
+    // so the old generator can be destroyed as soon as these calls return.
     void clear_event_generator();
     void register_event_generator(EventGenerator* generator);
 
-    static EventDispatcher& instance() { 
+    // Core1 sleeps whenever it is waiting on the state machine, which at low
+    // rates can be for many seconds. Ringing the doorbell wakes it, throws
+    // away everything already queued and starts again from a clean timeline,
+    // so a stop request, a new generator or new parameters take effect within
+    // microseconds. The functions here ring it themselves, generators should
+    // ring it when they publish new parameters.
+    void notify_dispatcher();
+
+    // Events are sent to the set_charges state machine as (delay, patterns)
+    // records, with the delay counted in PIO cycles. Each record can carry
+    // two patterns, so the events of a burst go two to a FIFO word. Events
+    // that carry a SCALE setting (see EventGenerator::make_extended_pattern)
+    // are preceded by a record that writes the SCALE DAC, if it is not
+    // already set. In streaming mode the records are written into a
+    // double-buffered ring that DMA feeds to the PIO, so core1 only has to
+    // keep the buffers filled. In direct mode core1 pushes each record into
+    // the TX FIFO itself.
+    void set_streaming_mode(bool streaming);
+    bool is_streaming_mode();
+
+    // Events are scheduled on an absolute timeline that starts with the
+    // stream, so rounding each delay to whole PIO cycles never accumulates
+    // and the mean rate is exactly the one the generator asks for. If the
+    // state machine is ever starved of records the timeline slips, and the
+    // events that follow are sent as quickly as possible until it has caught
+    // up. Each event that fires after its deadline is counted as late.
+    uint32_t late_event_count();
+    uint32_t max_lateness_us();
+    void reset_late_event_statistics();
+
+    // In pipeline mode the generator is run on core0, as a background task
+    // of the menu event loop, and handed to core1 in blocks of events through
+    // a lock-free queue. Core1 is then left with nothing to do but turn the
+    // events into records, so expensive generators can run at rates that one
+    // core could not sustain while also driving the state machine.
+    void set_pipeline_mode(bool pipeline);
+    bool is_pipeline_mode();
+    void run_pipeline_producer();
+
+    // The camera trigger on TRIG_PIN is driven by a second state machine,
+    // started by the set_charges state machine with an IRQ from the records
+    // of the events that are to be triggered, every Nth flash. Both count
+    // PIO cycles, so the rising edge is always offset_cycles from the strobe
+    // of DAC_EN, after it if positive and before it if negative, whatever
+    // the event rate. Triggered records hold a lead window long enough for
+    // the edge to come before the strobe, so events closer together than
+    // that are pushed back. The follower handles one pulse at a time, so a
+    // triggered event is also pushed back until the positive offset and the
+    // width of the previous pulse have passed, and counted as late if it
+    // was. TRIG_PIN has one owner at a time, the trigger cannot be enabled
+    // while the TriggerGenerator is running, in which case false is
+    // returned.
+    bool set_event_trigger(unsigned every_nth, int32_t offset_cycles, uint32_t width_cycles);
+    void disable_event_trigger();
+    bool is_event_trigger_enabled();
+    unsigned event_trigger_every_nth();
+    int32_t event_trigger_offset_cycles();
+    uint32_t event_trigger_width_cycles();
+
+    static int32_t max_event_trigger_offset_cycles() { return 1000000; }
+
+    static uint32_t stream_horizon_us() { return 10000; }
+    static uint32_t idle_record_us() { return 1000; }
+
+    static EventDispatcher& instance() {
         static EventDispatcher the_singleton;
-        return the_singleton; 
+        return the_singleton;
     }
 private:
     EventDispatcher();
     EventDispatcher(EventDispatcher&);
     EventDispatcher& operator=(EventDispatcher const&);
-    
+
     void run_dispatcher_loop();
+    void run_direct_loop();
+    void run_streaming_loop();
+    bool wait_for_tx_fifo_space();
+    void restart_state_machine();
+    void restart_trigger_state_machine();
+    bool count_triggered_event(uint32_t pattern);
+    static int event_scale(uint32_t pattern);
+    unsigned fill_stream_buffer(uint32_t* buffer, unsigned& nflash);
+    uint64_t next_record(uint32_t& delay_word, uint32_t& pattern_word);
+    uint64_t timeline_now_cycles();
+    void reset_timeline();
+    void catch_up_timeline();
+    void idle_timeline(uint64_t cycles);
+    void record_late_event(uint64_t lateness_cycles, unsigned nevent = 1);
+    EventGenerator* acquire_generator();
+    void release_generator();
     static void launch_dispatcher_thread();
-    
-    EventGenerator* generator_ = nullptr;
+    static void dma_irq_handler();
+    static void pio_irq_handler();
+    static uint32_t idle_wake_us() { return 100000; }
+    static void pipeline_background_task();
+    static uint32_t pipeline_task_interval_us() { return 1000; }
+    static uint32_t pipeline_producer_budget_us() { return 2000; }
+    static uint32_t pipeline_wait_us() { return 10; }
+    bool next_pipeline_block();
+
+    static const unsigned stream_buffer_words = 512; // (delay, patterns) pairs
+    static const unsigned event_block_size = 64;
+    static const unsigned pipeline_queue_blocks = 16;
+
+    struct EventBlock {
+        EventGenerator* generator;
+        unsigned nevent;
+        EventGenerator::Event events[event_block_size];
+    };
+
+    std::atomic<EventGenerator*> generator_ { nullptr };
+    std::atomic<EventGenerator*> generator_in_use_ { nullptr };
+
+    std::atomic<bool> run_dispatcher_ { false };
+    std::atomic<bool> dispatcher_running_ { false };
+    std::atomic<bool> streaming_ { true };
+    std::atomic<bool> reconfigure_ { false };
+    std::atomic<bool> pipeline_ { false };
+
+    std::atomic<uint32_t> late_event_count_ { 0 };
+    std::atomic<uint32_t> max_lateness_us_ { 0 };
+    std::atomic<bool> reset_late_event_statistics_ { false };
+
+    std::atomic<bool> trigger_enabled_ { false };
+    std::atomic<unsigned> trigger_every_nth_ { 1 };
+    std::atomic<int32_t> trigger_offset_cycles_ { 0 };
+    std::atomic<uint32_t> trigger_width_cycles_ { 125 };
+
+    PIO pio_ = nullptr;
+    uint sm_ = 0;
+    uint pio_offset_ = 0;
+    uint trigger_sm_ = 0;
+    uint trigger_pio_offset_ = 0;
+
+    EventGenerator::Event event_block_[event_block_size];
+    const EventGenerator::Event* event_block_events_ = event_block_;
+    unsigned event_block_nevent_ = 0;
+    unsigned event_block_ievent_ = 0;
+    EventGenerator* event_block_generator_ = nullptr;
+    SPSCQueue<EventBlock, pipeline_queue_blocks> pipeline_queue_;
+    bool pipeline_block_held_ = false;
+    bool pipeline_starved_ = false;
+    uint32_t stream_buffer_[2][stream_buffer_words];
+    volatile uint32_t dma_done_mask_ = 0; // channels finished since cleared, set by the IRQ
+    uint32_t cycles_per_us_ = 125;
+    uint64_t timeline_origin_us_ = 0;  // time at which the stream started
+    uint64_t timeline_cycles_q16_ = 0; // deadline of last event, 16 fractional bits
+    uint64_t sent_cycles_ = 0;         // cycles covered by the records sent
+    uint64_t nominal_cycles_ = 0;      // the same, had the PIO never been starved
+    uint32_t sent_flashes_ = 0;        // flashes in the records sent, wraps
+    uint64_t pending_delay_cycles_ = 0;
+    uint32_t pending_pattern_ = 0;
+    bool pending_record_ = false;
+    bool pending_trigger_ = false;
+    int pending_event_scale_ = -1;     // SCALE asked for by the pending event
+    bool pending_scale_write_ = false;
+    int current_scale_ = -1;           // SCALE after the records sent, -1 if unknown
 
-    bool run_dispatcher_ = false;
-    bool dispatcher_running_ = false;
-    mutex_t mutex_;
-};
\ No newline at end of file
+    // Trigger settings taken by core1 when the state machines are restarted
+    bool trigger_active_ = false;
+    unsigned trigger_active_every_nth_ = 1;
+    uint32_t trigger_lead_cycles_ = 0;  // lead window of triggered records
+    uint32_t trigger_spacing_cycles_ = 0; // shortest time between triggered strobes
+    uint64_t trigger_ready_cycles_ = 0; // earliest strobe of the next triggered record
+    unsigned trigger_count_ = 0;        // flashes since the last trigger
+};
@@ -1,7 +1,9 @@
 #include <cmath>
-#include <pico/double.h>
+
+#include <hardware/clocks.h>
 
 #include "build_date.hpp"
+#include "input_menu.hpp"
 #include "event_generators.hpp"
 #include "event_dispatcher.hpp"
 
@@ -9,12 +11,6 @@ namespace {
     static BuildDate build_date(__DATE__,__TIME__);
 }
 
-template<typename T> void lock_and_set(T& variable, const T& value) {
-    EventDispatcher::instance().lock();
-    variable = value;
-    EventDispatcher::instance().unlock();
-}
-
 EventGenerator::~EventGenerator()
 {
     // nothing to see here
@@ -23,7 +19,19 @@ EventGenerator::~EventGenerator()
 SingleLEDEventGenerator::SingleLEDEventGenerator(): 
     SimpleItemValueMenu(make_menu_items(), "Single LED event generator") 
 {
-    // nothing to see here
+    set_dispatch_mode_value(false);
+    set_late_events_value(false);
+    set_pipeline_mode_value(false);
+    EventDispatcher& dispatcher = EventDispatcher::instance();
+    if(dispatcher.is_event_trigger_enabled()) {
+        trigger_every_nth_ = dispatcher.event_trigger_every_nth();
+    }
+    trigger_offset_cycles_ = dispatcher.event_trigger_offset_cycles();
+    set_trigger_every_nth_value(false);
+    set_trigger_offset_value(false);
+    set_amp_range_value(false);
+    published_ = make_parameters();
+    parameters_.publish(published_);
 }
 
 SingleLEDEventGenerator::~SingleLEDEventGenerator()
@@ -31,32 +39,139 @@ SingleLEDEventGenerator::~SingleLEDEventGenerator()
     // nothing to see here
 }
 
-bool SingleLEDEventGenerator::isEnabled()
+void SingleLEDEventGenerator::set_dispatch_mode_value(bool draw)
 {
-    return enabled_;
+    if(EventDispatcher::instance().is_streaming_mode()) { menu_items_[8].value = "Streaming"; }
+    else { menu_items_[8].value = "Direct"; }
+    if(draw)draw_item_value(8);
 }
 
-void SingleLEDEventGenerator::generateNextEvent()
+void SingleLEDEventGenerator::set_pipeline_mode_value(bool draw)
 {
-    // nothing to see here
+    if(EventDispatcher::instance().is_pipeline_mode()) { menu_items_[10].value = "Core 0 pipeline"; }
+    else { menu_items_[10].value = "Core 1"; }
+    if(draw)draw_item_value(10);
+}
+
+void SingleLEDEventGenerator::set_trigger_every_nth_value(bool draw)
+{
+    if(trigger_every_nth_ == 0) { menu_items_[11].value = "off"; }
+    else { menu_items_[11].value.assign_int(trigger_every_nth_); }
+    if(draw)draw_item_value(11);
+}
+
+void SingleLEDEventGenerator::set_trigger_offset_value(bool draw)
+{
+    menu_items_[12].value.assign_int(trigger_offset_cycles_);
+    if(draw)draw_item_value(12);
+}
+
+void SingleLEDEventGenerator::apply_event_trigger()
+{
+    // The trigger stays with the dispatcher when the menu is closed, so the
+    // camera follows whichever generator is registered next
+    if(trigger_every_nth_ == 0) {
+        EventDispatcher::instance().disable_event_trigger();
+    } else {
+        uint32_t width_cycles = uint64_t(clock_get_hz(clk_sys)) * trigger_width_ns() / 1000000000;
+        if(not EventDispatcher::instance().set_event_trigger(trigger_every_nth_,
+                trigger_offset_cycles_, width_cycles)) {
+            // The TriggerGenerator has TRIG_PIN
+            trigger_every_nth_ = 0;
+            beep();
+        }
+    }
+}
+
+void SingleLEDEventGenerator::set_late_events_value(bool draw)
+{
+    uint32_t count = EventDispatcher::instance().late_event_count();
+    ItemValue value;
+    value.assign_int(count);
+    if(count) {
+        value.append(" (").append_int(EventDispatcher::instance().max_lateness_us()).append(" us)");
+    }
+    if(value != menu_items_[9].value) {
+        menu_items_[9].value = value;
+        if(draw)draw_item_value(9);
+    }
 }
 
-uint32_t SingleLEDEventGenerator::nextEventDelay()
+SingleLEDEventGenerator::Parameters SingleLEDEventGenerator::make_parameters() const
 {
-    if(freq_mode_ == 0) {
-        return period_us_;
+    Parameters parameters;
+    parameters.freq_mode = freq_mode_;
+    parameters.period_us_q16 = freq_ > 0 ? uint64_t(period_us_ * 65536.0 + 0.5) : 0;
+    parameters.amp_mode  = amp_mode_;
+    parameters.amp       = amp_;
+    parameters.extended_amp = extended_amp_;
+    parameters.rc_mode   = rc_mode_;
+    parameters.ac        = ac_;
+    parameters.ar        = ar_;
+    parameters.enabled   = enabled_ and freq_ > 0;
+    return parameters;
+}
+
+void SingleLEDEventGenerator::publish_parameters()
+{
+    // Only wake the dispatcher if something has changed, as it drops the
+    // events it has queued and starts again when it is woken
+    Parameters parameters = make_parameters();
+    if(parameters == published_) {
+        return;
+    }
+    published_ = parameters;
+    parameters_.publish(parameters);
+    EventDispatcher::instance().notify_dispatcher();
+}
+
+unsigned SingleLEDEventGenerator::nextEvents(Event* events, unsigned max_events, uint32_t horizon_us)
+{
+    // Pick up any parameters published since the last block
+    parameters_.read_if_changed(active_, active_seq_);
+    if(not active_.enabled) {
+        return 0;
+    }
+    unsigned nevent = 0;
+    const uint64_t horizon_us_q16 = uint64_t(horizon_us) << 16;
+    uint64_t total_delay_us_q16 = 0;
+    while(nevent < max_events and total_delay_us_q16 < horizon_us_q16) {
+        events[nevent].delay_us_q16 = nextEventDelay();
+        events[nevent].pattern = nextEventPattern();
+        total_delay_us_q16 += events[nevent].delay_us_q16;
+        ++nevent;
+    }
+    return nevent;
+}
+
+uint64_t SingleLEDEventGenerator::nextEventDelay()
+{
+    // Delays keep their fractional microseconds, the dispatcher accumulates
+    // them on its timeline so the mean rate is exact
+    if(active_.freq_mode == 0) {
+        return active_.period_us_q16;
     } else {
-        return -std::log(double(rand())/double(RAND_MAX))*period_us_;
+        // Drop 8 fractional bits of the period so the product fits 64 bits
+        return ((active_.period_us_q16 >> 8) * rng_.exponential_q24()) >> 16;
     }
 }
 
-uint32_t SingleLEDEventGenerator::nextEventPattern(uint32_t* array)
+uint32_t SingleLEDEventGenerator::nextEventPattern()
 {
-    uint x = rand() & 0xFFFF;
-    if(amp_mode_ == 0)x = (x&0xFF00) | (amp_&0x00FF);
-    if(rc_mode_ == 0)x = (x&0x00FF) | ((ar_&0x000F)<<8) | ((ac_&0x000F)<<12);
-    array[0] = x;
-    return 1;
+    if(active_.extended_amp) {
+        // The amplitude is mapped onto the SCALE and VDAC settings, which
+        // leaves the upper 20 random bits for the amplitude and the position
+        uint x = rng_.next() >> 12;
+        unsigned amp = active_.amp_mode == 0 ? active_.amp : (x & AmplitudeRanges::max_amplitude());
+        int ar = active_.rc_mode == 0 ? active_.ar : (x >> 12) & 0x000F;
+        int ac = active_.rc_mode == 0 ? active_.ac : (x >> 16) & 0x000F;
+        return make_extended_pattern(ar, ac, amp);
+    }
+    uint x = rng_.next() >> 16;
+    int amp = active_.amp_mode == 0 ? active_.amp : x & 0x00FF;
+    int ar = active_.rc_mode == 0 ? active_.ar : (x >> 8) & 0x000F;
+    int ac = active_.rc_mode == 0 ? active_.ac : (x >> 12) & 0x000F;
+    return make_pattern(ar, ac, amp);
 }
 
 bool SingleLEDEventGenerator::process_key_press(int key, int key_count, int& return_code, 
@@ -69,14 +184,15 @@ bool SingleLEDEventGenerator::process_key_press(int key, int key_count, int& ret
         set_freq_mode_value();
         break;
     case '+':
-        if(freq_<30000.0) {
+        if(freq_<max_freq()) {
             double df = 0.1;
-            if(freq_ >= 3000 && key_count>10) { df = 1000; }
+            if(freq_ >= 30000 && key_count>10) { df = 10000; }
+            else if(freq_ >= 30000 || (freq_ >= 3000 && key_count>10)) { df = 1000; }
             else if(freq_ >= 3000 || (freq_ >= 300 && key_count>10)) { df = 100; }
             else if(freq_ >= 300 || (freq_ >= 30 && key_count>10)) { df = 10.0; }
             else if(freq_ >= 30 || key_count>10) { df = 1.0; }
-            lock_and_set(freq_, std::min((std::floor(freq_/df + 0.5) + 1.0) * df, 30000.0));
-            lock_and_set(period_us_, 1000000.0/freq_);
+            freq_ = std::min((std::floor(freq_/df + 0.5) + 1.0) * df, max_freq());
+            period_us_ = 1000000.0/freq_;
             set_freq_value();
         }
         break;
@@ -84,115 +200,163 @@ bool SingleLEDEventGenerator::process_key_press(int key, int key_count, int& ret
     case '_':
         if(freq_>0.0) {
             double df = 0.1;
-            if(freq_ > 3000 && key_count>10) { df = 1000; }
+            if(freq_ > 30000 && key_count>10) { df = 10000; }
+            else if(freq_ > 30000 || (freq_ > 3000 && key_count>10)) { df = 1000; }
             else if(freq_ > 3000 || (freq_ > 300 && key_count>10)) { df = 100; }
             else if(freq_ > 300 || (freq_ > 30 && key_count>10)) { df = 10.0; }
             else if(freq_ > 30 || key_count>10) { df = 1.0; }
-            lock_and_set(freq_, std::max((std::floor(freq_/df + 0.5) - 1.0) * df, 0.0));
-            lock_and_set(period_us_, 1000000.0/freq_);
+            freq_ = std::max((std::floor(freq_/df + 0.5) - 1.0) * df, 0.0);
+            period_us_ = 1000000.0/freq_;
             set_freq_value();
         }
         break;
-    case '0': case '1': case '2': case '3': case '4': case '5':
+    case '0': case '1': case '2': case '3': case '4': case '5': case '6':
         if(key_count >= 10) {
             double new_freq = 0.1;
             while(key > '0') { new_freq *= 10.0; --key; }
             if(freq_ != new_freq) {
-                lock_and_set(freq_, new_freq);
-                lock_and_set(period_us_, 1000000.0/freq_);
+                freq_ = new_freq;
+                period_us_ = 1000000.0/freq_;
                 set_freq_value();
             }
         }
         break;
     case 'A':
-        lock_and_set(amp_mode_, (amp_mode_ == 0) ? 1 : 0);
+        amp_mode_ = (amp_mode_ == 0) ? 1 : 0;
         set_amp_mode_value();
         break;
     case '>':
-        if(amp_mode_ == 0 and amp_<255) {
-            lock_and_set(amp_, std::min(amp_ + (key_count >= 15 ? 5 : 1), 255));
+        if(amp_mode_ == 0 and amp_<max_amp()) {
+            amp_ = std::min(amp_ + (key_count >= 15 ? 5 : 1), max_amp());
             set_amp_value();
         }
         break;
     case '<':
         if(amp_mode_ == 0 and amp_>0) {
-            lock_and_set(amp_, std::max(amp_ - (key_count >= 15 ? 5 : 1), 0));
+            amp_ = std::max(amp_ - (key_count >= 15 ? 5 : 1), 0);
             set_amp_value();
         }
         break;
     case 'P':
-        lock_and_set(rc_mode_, (rc_mode_ == 0) ? 1 : 0);
+        rc_mode_ = (rc_mode_ == 0) ? 1 : 0;
         set_rc_mode_value();
         break;
     case KEY_UP:
         if(rc_mode_ == 0 and ar_>0) {
-            lock_and_set(ar_, std::max(ar_-1, 0));
+            ar_ = std::max(ar_-1, 0);
             set_rc_value();
         }
         break;
     case KEY_DOWN:
         if(rc_mode_ == 0 and ar_<15) {
-            lock_and_set(ar_, std::min(ar_+1, 15));
+            ar_ = std::min(ar_+1, 15);
             set_rc_value();
         }
         break;
     case KEY_LEFT:
         if(rc_mode_ == 0 and ac_>0) {
-            lock_and_set(ac_, std::max(ac_-1, 0));
+            ac_ = std::max(ac_-1, 0);
             set_rc_value();
         }
         break;
     case KEY_RIGHT:
         if(rc_mode_ == 0 and ac_<15) {
-            lock_and_set(ac_, std::min(ac_+1, 15));
+            ac_ = std::min(ac_+1, 15);
             set_rc_value();
         }
         break;
     case KEY_PAGE_UP:
         if(rc_mode_ == 0 and ar_>0) {
-            lock_and_set(ar_, 0);
+            ar_ = 0;
             set_rc_value();
         }
         break;
     case KEY_PAGE_DOWN:
         if(rc_mode_ == 0 and ar_<15) {
-            lock_and_set(ar_, 15);
+            ar_ = 15;
             set_rc_value();
         }
         break;
     case KEY_HOME:
         if(rc_mode_ == 0 and ac_>0) {
-            lock_and_set(ac_, 0);
+            ac_ = 0;
             set_rc_value();
         }
         break;
     case KEY_END:
         if(rc_mode_ == 0 and ac_<15) {
-            lock_and_set(ac_, 15);
+            ac_ = 15;
             set_rc_value();
         }
         break;
     case 'S':
         if(enabled_ and key_count == 1) {
-            lock_and_set(enabled_, false);
+            enabled_ = false;
             set_enabled_value();
-        } else if(key_count >= 10) {
-            lock_and_set(enabled_, true);
+        } else if(key_count >= 10 and not enabled_) {
+            enabled_ = true;
             set_enabled_value();
+            EventDispatcher::instance().reset_late_event_statistics();
+            set_late_events_value();
         }
         break;
     case 's':
         if(enabled_) {
-            lock_and_set(enabled_, false);
+            enabled_ = false;
             set_enabled_value();
         }
         break;
+    case 'M':
+        EventDispatcher::instance().set_streaming_mode(
+            !EventDispatcher::instance().is_streaming_mode());
+        set_dispatch_mode_value();
+        break;
+    case 'L':
+        EventDispatcher::instance().reset_late_event_statistics();
+        set_late_events_value();
+        break;
+    case 'G':
+        EventDispatcher::instance().set_pipeline_mode(
+            !EventDispatcher::instance().is_pipeline_mode());
+        set_pipeline_mode_value();
+        break;
+    case 'X':
+    case 'x':
+        extended_amp_ = not extended_amp_;
+        amp_ = std::min(amp_, max_amp());
+        set_amp_range_value();
+        set_amp_value();
+        break;
+    case 'T':
+    case 't':
+        if(InplaceInputMenu::input_value_in_range(trigger_every_nth_, 0, 1000000, this, 11)) {
+            apply_event_trigger();
+        }
+        set_trigger_every_nth_value();
+        break;
+    case 'O':
+    case 'o':
+        if(InplaceInputMenu::input_value_in_range(trigger_offset_cycles_,
+                -EventDispatcher::max_event_trigger_offset_cycles(),
+                EventDispatcher::max_event_trigger_offset_cycles(), this, 12)) {
+            apply_event_trigger();
+        }
+        set_trigger_offset_value();
+        break;
     }
+    publish_parameters();
     return true;
 }
 
 bool SingleLEDEventGenerator::process_timer(bool controller_is_connected, int& return_code,
     absolute_time_t& next_timer)
 {
+    late_events_timer_count_ += 1;
+    if(late_events_timer_count_ == 100) {
+        if(controller_is_connected) {
+            set_late_events_value();
+        }
+        late_events_timer_count_ = 0;
+    }
     return true;
 }
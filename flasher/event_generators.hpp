@@ -1,16 +1,47 @@
 #pragma once
 
 #include <string>
+#include <cmath>
 
 #include "menu.hpp"
+#include "seqlock.hpp"
+#include "rng.hpp"
+#include "amplitude_ranges.hpp"
+#include "amplitude_calibration.hpp"
 
 class EventGenerator {
 public:
+    struct Event {
+        uint64_t delay_us_q16; // delay before this event, 16 fractional bits
+        uint32_t pattern;      // set_charges pattern, zero for no flash
+    };
+
     virtual ~EventGenerator();
-    virtual bool isEnabled() = 0;
-    virtual void generateNextEvent() = 0;
-    virtual uint32_t nextEventDelay() = 0;
-    virtual uint32_t nextEventPattern(uint32_t* array) = 0;
+
+    // Fill "events" with up to "max_events" events, stopping early once the
+    // sum of their delays reaches "horizon_us". Returns the number of events
+    // generated, zero if the generator is disabled. Called on the dispatcher
+    // core, once per block of events.
+    virtual unsigned nextEvents(Event* events, unsigned max_events, uint32_t horizon_us) = 0;
+
+    // Pack the row, column and amplitude of one LED into a pattern, the
+    // amplitude going through the calibration of the LED
+    static uint32_t make_pattern(int ar, int ac, int amp) {
+        amp = AmplitudeCalibration::instance().code(ar, ac, amp);
+        return amp | ((ar & 0x000F) << 8) | ((ac & 0x000F) << 12);
+    }
+
+    // Patterns can also carry a SCALE DAC setting, in bits 23-16, which the
+    // dispatcher writes before the event if it is not already set
+    static uint32_t scale_flag() { return 1U << 24; }
+
+    // Pack an LED with an amplitude of up to AmplitudeRanges::max_amplitude(),
+    // given by the SCALE and VDAC settings together
+    static uint32_t make_extended_pattern(int ar, int ac, unsigned amplitude) {
+        uint16_t entry = AmplitudeRanges::instance().lookup(amplitude);
+        return make_pattern(ar, ac, AmplitudeRanges::vdac(entry))
+            | (uint32_t(AmplitudeRanges::scale(entry)) << 16) | scale_flag();
+    }
 };
 
 class SingleLEDEventGenerator: public EventGenerator, public SimpleItemValueMenu {
@@ -18,10 +49,7 @@ public:
     SingleLEDEventGenerator();
     virtual ~SingleLEDEventGenerator();
 
-    bool isEnabled() final;
-    void generateNextEvent() final;
-    uint32_t nextEventDelay() final;
-    uint32_t nextEventPattern(uint32_t* array) final;
+    unsigned nextEvents(Event* events, unsigned max_events, uint32_t horizon_us) final;
 
     bool process_key_press(int key, int key_count, int& return_code,
         const std::vector<std::string>& escape_sequence_parameters,
@@ -34,12 +62,18 @@ private:
         std::vector<MenuItem> menu_items;
         menu_items.emplace_back("F       : Set frequency mode (Poisson/Periodic)", 8, "Periodic");
         menu_items.emplace_back("+/-     : Increase/decrease frequency", 10, "100.0 Hz");
-        menu_items.emplace_back("0 to 5  : Set frequency to 10^(N-1) Hz (press and hold)", 0, "");
+        menu_items.emplace_back("0 to 6  : Set frequency to 10^(N-1) Hz (press and hold)", 0, "");
         menu_items.emplace_back("A       : Set LED amplitude mode (Random/Fixed)", 6, "Fixed");
-        menu_items.emplace_back("</>     : Increase/decrease fixed LED amplitude", 3, "0");
+        menu_items.emplace_back("</>     : Increase/decrease fixed LED amplitude", 4, "0");
         menu_items.emplace_back("P       : Set LED position mode (Random/Fixed)", 6, "Fixed");
         menu_items.emplace_back("Cursors : Change LED column & row", 3, "A1");
         menu_items.emplace_back("S       : Start (press and hold) or stop flasher", 4, "off");
+        menu_items.emplace_back("M       : Set dispatch mode (Streaming/Direct)", 9, "Streaming");
+        menu_items.emplace_back("L       : Reset late event count (max lateness)", 20, "0");
+        menu_items.emplace_back("G       : Set generator core (Core 1/Core 0 pipeline)", 15, "Core 1");
+        menu_items.emplace_back("T       : Camera trigger every Nth flash (0 = off)", 6, "off");
+        menu_items.emplace_back("O       : Trigger offset (PIO cycles, <0 leads DAC_EN)", 8, "0");
+        menu_items.emplace_back("X       : Set amplitude range (8 bit/Extended)", 8, "8 bit");
         return menu_items;
     }
 
@@ -49,9 +83,7 @@ private:
         if(draw)draw_item_value(0);
     }
     void set_freq_value(bool draw = true) { 
-        char buffer[20];
-        sprintf(buffer,"%.1f Hz",freq_);
-        menu_items_[1].value = buffer; 
+        menu_items_[1].value.assign_fixed(std::lround(freq_*10), 1).append(" Hz");
         if(draw)draw_item_value(1); 
     }
 
@@ -62,7 +94,7 @@ private:
         set_amp_value(draw);
     }
     void set_amp_value(bool draw = true) { 
-        if(amp_mode_ == 0) { menu_items_[4].value = std::to_string(amp_); }
+        if(amp_mode_ == 0) { menu_items_[4].value.assign_int(amp_); }
         else { menu_items_[4].value = "N/A"; }
         if(draw)draw_item_value(4); 
     }
@@ -74,9 +106,7 @@ private:
         set_rc_value(draw);
     }
     void set_rc_value(bool draw = true) { 
-        if(rc_mode_ == 0) {
-            menu_items_[6].value = std::string(1, char('A' + ar_)) 
-                + std::to_string(ac_); }
+        if(rc_mode_ == 0) { rc_to_value_string(menu_items_[6].value, ar_, ac_); }
         else { menu_items_[6].value = "N/A"; }
         if(draw)draw_item_value(6);
     }
@@ -87,13 +117,65 @@ private:
         if(draw)draw_item_value(7); 
     }
 
+    void set_dispatch_mode_value(bool draw = true);
+    void set_late_events_value(bool draw = true);
+    void set_pipeline_mode_value(bool draw = true);
+    void set_trigger_every_nth_value(bool draw = true);
+    void set_trigger_offset_value(bool draw = true);
+    void set_amp_range_value(bool draw = true) {
+        if(extended_amp_) { menu_items_[13].value = "Extended"; }
+        else { menu_items_[13].value = "8 bit"; }
+        if(draw)draw_item_value(13);
+    }
+    int max_amp() const { return extended_amp_ ? AmplitudeRanges::max_amplitude() : 255; }
+    void apply_event_trigger();
+
+    static double max_freq() { return 100000.0; } // Hz
+    static uint32_t trigger_width_ns() { return 1000; }
+
+    // Parameters used by the dispatcher core to generate events. They are
+    // edited on the menu core and published as one block after each key press.
+    struct Parameters {
+        int freq_mode;
+        uint64_t period_us_q16; // fixed point with 16 fractional bits
+        int amp_mode;
+        int amp;
+        bool extended_amp;
+        int rc_mode;
+        int ac;
+        int ar;
+        bool enabled;
+
+        bool operator==(const Parameters& o) const {
+            return freq_mode == o.freq_mode and period_us_q16 == o.period_us_q16
+                and amp_mode == o.amp_mode and amp == o.amp
+                and extended_amp == o.extended_amp and rc_mode == o.rc_mode
+                and ac == o.ac and ar == o.ar and enabled == o.enabled;
+        }
+    };
+
+    Parameters make_parameters() const;
+    void publish_parameters();
+    uint64_t nextEventDelay();
+    uint32_t nextEventPattern();
+
+    SeqLock<Parameters> parameters_;
+    Parameters published_ = {};
+    Parameters active_ = {};
+    uint32_t active_seq_ = SeqLock<Parameters>::unread_seq();
+    FastRNG rng_;
+
     int freq_mode_ = 0;
     double freq_ = 100; // Hz
     double period_us_ = 1000000.0/freq_;
     int amp_mode_ = 0;
     int amp_ = 0;
+    bool extended_amp_ = false;
     int rc_mode_ = 0;
     int ac_ = 0;
     int ar_ = 0;
     bool enabled_ = false;
+    unsigned late_events_timer_count_ = 0;
+    int trigger_every_nth_ = 0;
+    int trigger_offset_cycles_ = 0;
 };
\ No newline at end of file
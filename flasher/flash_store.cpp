@@ -0,0 +1,95 @@
+#include <cstring>
+
+#include <pico/flash.h>
+#include <hardware/flash.h>
+
+#include "build_date.hpp"
+#include "flash_store.hpp"
+
+namespace {
+    static BuildDate build_date(__DATE__,__TIME__);
+
+    struct BlockHeader {
+        uint32_t magic;
+        uint32_t size;
+        uint32_t checksum;
+        uint32_t reserved;
+    };
+
+    struct WriteRequest {
+        uint32_t flash_offset;
+        BlockHeader header;
+        const uint8_t* data;
+    };
+
+    uint32_t slot_offset(FlashStore::Slot slot)
+    {
+        return PICO_FLASH_SIZE_BYTES - (unsigned(slot) + 1) * FLASH_SECTOR_SIZE;
+    }
+
+    uint32_t checksum(const uint8_t* data, size_t size)
+    {
+        // FNV-1a
+        uint32_t hash = 2166136261u;
+        for(size_t i=0; i<size; ++i) {
+            hash = (hash ^ data[i]) * 16777619u;
+        }
+        return hash;
+    }
+
+    // Runs with the other core locked out and interrupts disabled, so the
+    // sector is programmed a page at a time from a buffer on the stack
+    void write_block(void* param)
+    {
+        const WriteRequest* req = static_cast<const WriteRequest*>(param);
+        flash_range_erase(req->flash_offset, FLASH_SECTOR_SIZE);
+        size_t total = sizeof(BlockHeader) + req->header.size;
+        for(size_t page=0; page<total; page+=FLASH_PAGE_SIZE) {
+            uint8_t buffer[FLASH_PAGE_SIZE];
+            std::memset(buffer, 0xFF, FLASH_PAGE_SIZE);
+            for(size_t i=0; i<FLASH_PAGE_SIZE and page+i<total; ++i) {
+                size_t j = page + i;
+                buffer[i] = j<sizeof(BlockHeader) ?
+                    reinterpret_cast<const uint8_t*>(&req->header)[j] :
+                    req->data[j-sizeof(BlockHeader)];
+            }
+            flash_range_program(req->flash_offset + page, buffer, FLASH_PAGE_SIZE);
+        }
+    }
+}
+
+size_t FlashStore::max_size()
+{
+    return FLASH_SECTOR_SIZE - sizeof(BlockHeader);
+}
+
+bool FlashStore::save(Slot slot, uint32_t magic, const void* data, size_t size)
+{
+    if(slot >= SLOT_NUM_SLOTS or size > max_size()) {
+        return false;
+    }
+    WriteRequest req;
+    req.flash_offset = slot_offset(slot);
+    req.header.magic = magic;
+    req.header.size = size;
+    req.header.checksum = checksum(static_cast<const uint8_t*>(data), size);
+    req.header.reserved = 0;
+    req.data = static_cast<const uint8_t*>(data);
+    return flash_safe_execute(write_block, &req, 100) == PICO_OK;
+}
+
+bool FlashStore::load(Slot slot, uint32_t magic, void* data, size_t size)
+{
+    if(slot >= SLOT_NUM_SLOTS or size > max_size()) {
+        return false;
+    }
+    const uint8_t* block = reinterpret_cast<const uint8_t*>(XIP_BASE + slot_offset(slot));
+    BlockHeader header;
+    std::memcpy(&header, block, sizeof(header));
+    if(header.magic != magic or header.size != size
+            or header.checksum != checksum(block + sizeof(header), size)) {
+        return false;
+    }
+    std::memcpy(data, block + sizeof(header), size);
+    return true;
+}
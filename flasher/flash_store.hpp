@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// Keeps small blocks of settings, such as the LED delay map, in the last
+// sectors of the flash, one sector per slot. Each block is stored behind a
+// header with its magic number, size and checksum, so that a block that was
+// never written, or was written by another version of the firmware, is
+// rejected when it is loaded. Writing uses flash_safe_execute, so it is safe
+// while the event dispatcher is running on core1, which pauses for the time
+// it takes to erase and program the sector.
+class FlashStore {
+public:
+    enum Slot {
+        SLOT_DELAY_MAP,
+        SLOT_AMPLITUDE_CALIBRATION,
+        SLOT_NUM_SLOTS // MUST BE LAST ITEM IN LIST
+    };
+
+    static bool save(Slot slot, uint32_t magic, const void* data, size_t size);
+    static bool load(Slot slot, uint32_t magic, void* data, size_t size);
+    static size_t max_size();
+};
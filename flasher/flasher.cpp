@@ -14,6 +14,7 @@
 #include "main_menu.hpp"
 #include "event_generators.hpp"
 #include "event_dispatcher.hpp"
+#include "amplitude_calibration.hpp"
 
 namespace {
     static BuildDate build_date(__DATE__,__TIME__);
@@ -48,6 +49,8 @@ int main()
 
     stdio_init_all();
 
+    AmplitudeCalibration::construct();
+
     // EventDispatcher::instance().start_dispatcher();
 
     MainMenu menu;
@@ -0,0 +1,58 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "key_codes.hpp"
+#include "escape_decoder.hpp"
+
+// Decodes typical sequences many times over and reports the throughput in
+// bytes per second, checking on the way that each decodes to its key
+namespace {
+    struct Sequence {
+        const char* name;
+        const char* bytes;
+        int key;
+    };
+
+    const Sequence sequences[] = {
+        { "Cursor key ESC[A", "\033[A", KeyCodes::KEY_UP },
+        { "Keypad key ESCOp", "\033Op", '0' },
+        { "Function key ESC[24~", "\033[24~", KeyCodes::KEY_F12 },
+        { "Position report ESC[24;80R", "\033[24;80R", KeyCodes::CURSOR_POSITION_REPORT } };
+
+    bool benchmark(const Sequence& sequence, unsigned nsample) {
+        EscapeSequenceDecoder decoder;
+        unsigned nbyte = strlen(sequence.bytes);
+        unsigned nmatch = 0;
+        auto t0 = std::chrono::steady_clock::now();
+        for(unsigned i=0; i<nsample; ++i) {
+            decoder.start();
+            int key = KeyCodes::INCOMPLETE_ESCAPE_SEQUENCE;
+            for(unsigned j=1; j<nbyte; ++j) {
+                key = decoder.decode(sequence.bytes[j]);
+            }
+            nmatch += (key == sequence.key);
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(t1-t0).count();
+        double nbyte_total = double(nsample) * double(nbyte);
+        printf("%-30s : %7.2f ns/byte, %8.1f MB/s\n", sequence.name,
+            seconds * 1e9 / nbyte_total, nbyte_total / seconds * 1e-6);
+        if(nmatch != nsample) {
+            printf("%-30s : decoded to the wrong key\n", sequence.name);
+            return false;
+        }
+        return true;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    unsigned nsample = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000000;
+    bool ok = true;
+    for(const auto& sequence : sequences) {
+        ok = benchmark(sequence, nsample) and ok;
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
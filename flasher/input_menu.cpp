@@ -2,6 +2,7 @@
 #include <string>
 
 #include <cstring>
+#include <cstdlib>
 #include <cstdio>
 #include <cctype>
 
@@ -156,7 +157,7 @@ bool InplaceInputMenu::process_timer(bool controller_is_connected, int& return_c
                     save_cursor();
                     highlight();
                 }
-                putchar_raw(blink_on_ ? ' ' : '_');
+                putchar_buffered(blink_on_ ? ' ' : '_');
                 if(do_highlight_) {
                     restore_cursor();
                 }
@@ -188,11 +189,11 @@ void InplaceInputMenu::draw_value()
         save_cursor();
         highlight();
     }
-    for(unsigned i=0;i<value_.size();++i)putchar_raw(value_[i]);
+    for(unsigned i=0;i<value_.size();++i)putchar_buffered(value_[i]);
     if(value_.size() < max_value_size_) {
-        putchar_raw(blink_on_ ? ' ' : '_');
+        putchar_buffered(blink_on_ ? ' ' : '_');
     }
-    for(unsigned i=value_.size()+1;i<max_value_size_;++i)putchar_raw('_');
+    for(unsigned i=value_.size()+1;i<max_value_size_;++i)putchar_buffered('_');
     if(do_highlight_) {
         restore_cursor();
     }
@@ -200,16 +201,8 @@ void InplaceInputMenu::draw_value()
 
 void InplaceInputMenu::cancelled()
 {
-    curpos(r_+1, c_+1);
-    if(do_highlight_) {
-        save_cursor();
-        highlight();
-    }
-    for(unsigned i=0;i<max_value_size_;++i)putchar_raw('X');
-    if(do_highlight_) {
-        restore_cursor();
-    }
-    sleep_ms(750);
+    show_transient(r_+1, c_+1, std::string(max_value_size_, 'X'), do_highlight_,
+        cancelled_display_us());
 }
 
 bool InplaceInputMenu::input_value_in_range(int& value, int value_min, int value_max,
@@ -319,9 +312,8 @@ const std::string& InputMenu::get_value() const
 
 void InputMenu::cancelled()
 {
-    curpos(frame_r_+5, frame_c_+ 4);
-    puts_center_filled("  CANCELLED  ", frame_w_-6,'X');
-    sleep_ms(750);
+    show_transient(frame_r_+5, frame_c_+4, center_filled("  CANCELLED  ", frame_w_-6, 'X'),
+        false, InplaceInputMenu::cancelled_display_us());
 }
 
 int InputMenu::row()
@@ -333,3 +325,42 @@ int InputMenu::col()
 {
     return frame_c_+prompt_.size()+4;
 }
+
+int InputMenu::input_byte_table(uint8_t* values, unsigned max_values,
+    const std::string& title, Menu* base_menu)
+{
+    unsigned nvalue = 0;
+    while(true) {
+        InputMenu input(60, title, std::string("Values ")+std::to_string(nvalue)+" : ",
+            VI_STRING, base_menu);
+        if(input.event_loop()!=1) {
+            input.cancelled();
+            return -1;
+        }
+        const std::string& line = input.get_value();
+        if(line.empty()) {
+            return nvalue;
+        }
+        // Values are only kept once the whole line has been read, so a bad
+        // one cannot leave the table shifted
+        unsigned nline_value = nvalue;
+        const char* p = line.c_str();
+        while(*p) {
+            if(*p==' ' or *p==',') {
+                ++p;
+                continue;
+            }
+            char* end;
+            long val = std::strtol(p, &end, 10);
+            if(end==p or (*end and *end!=' ' and *end!=',')
+                    or val<0 or val>255 or nline_value==max_values) {
+                beep();
+                nline_value = nvalue;
+                break;
+            }
+            values[nline_value++] = val;
+            p = end;
+        }
+        nvalue = nline_value;
+    }
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <cstdint>
 
 #include "menu.hpp"
 
@@ -21,6 +22,7 @@ public:
         absolute_time_t& next_timer) override;
     const std::string& get_value() const { return value_; }
     void cancelled();
+    static uint64_t cancelled_display_us() { return 750000; }
 
     static bool input_value_in_range(int& value, int value_min, int value_max,
         SimpleItemValueMenu* base_menu, int iitem, unsigned max_value_size = 0);
@@ -64,6 +66,14 @@ public:
     void cancelled();
     int row() override;
     int col() override;
+
+    // Read a table of values from 0 to 255 as lines of decimal numbers
+    // separated by spaces or commas, which can be pasted into the terminal,
+    // until an empty line. A line with any bad value is rejected as a whole,
+    // with a beep, and can be entered again. Returns the number of values, or
+    // -1 if cancelled.
+    static int input_byte_table(uint8_t* values, unsigned max_values,
+        const std::string& title, Menu* base_menu = nullptr);
 private:
     InplaceInputMenu iim_;
     Menu* base_menu_ = nullptr;
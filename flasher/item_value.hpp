@@ -0,0 +1,86 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <cstdint>
+
+// Short string held in a fixed-size buffer, for the values shown in the
+// menus, so that updating a value never touches the heap. Numbers are
+// formatted with std::to_chars, which is far smaller and faster than the
+// printf family. Anything past the capacity is silently dropped, the menus
+// clip values to the width of their column in any case.
+class ItemValue {
+public:
+    static constexpr unsigned capacity = 31;
+
+    ItemValue() { buffer_[0] = '\0'; }
+    ItemValue(const char* s) { assign(s); }
+
+    ItemValue& operator=(const char* s) { return assign(s); }
+
+    ItemValue& assign(const char* s) { size_ = 0; return append(s); }
+    ItemValue& assign(char c) { size_ = 0; return append(c); }
+    template<typename T> ItemValue& assign_int(T x) { size_ = 0; return append_int(x); }
+    ItemValue& assign_fixed(int32_t x, unsigned ndp) { size_ = 0; return append_fixed(x, ndp); }
+
+    ItemValue& append(const char* s) {
+        unsigned n = std::min<size_t>(strlen(s), capacity - size_);
+        memcpy(buffer_ + size_, s, n);
+        size_ += n;
+        buffer_[size_] = '\0';
+        return *this;
+    }
+
+    ItemValue& append(char c) {
+        if(size_ < capacity) {
+            buffer_[size_++] = c;
+            buffer_[size_] = '\0';
+        }
+        return *this;
+    }
+
+    template<typename T> ItemValue& append_int(T x) {
+        auto result = std::to_chars(buffer_ + size_, buffer_ + capacity, x);
+        if(result.ec == std::errc()) {
+            size_ = result.ptr - buffer_;
+        }
+        buffer_[size_] = '\0';
+        return *this;
+    }
+
+    // Fixed-point value with "ndp" decimal places, so 1234 with 2 places is
+    // written as "12.34"
+    ItemValue& append_fixed(int32_t x, unsigned ndp) {
+        uint32_t ax = x<0 ? -uint32_t(x) : uint32_t(x);
+        uint32_t scale = 1;
+        for(unsigned i=0; i<ndp; ++i) {
+            scale *= 10;
+        }
+        if(x<0) {
+            append('-');
+        }
+        append_int(ax / scale);
+        if(ndp) {
+            append('.');
+            uint32_t frac = ax % scale;
+            for(scale /= 10; scale > 1 and frac < scale; scale /= 10) {
+                append('0');
+            }
+            append_int(frac);
+        }
+        return *this;
+    }
+
+    const char* c_str() const { return buffer_; }
+    unsigned size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    bool operator==(const ItemValue& o) const {
+        return size_ == o.size_ and memcmp(buffer_, o.buffer_, size_) == 0; }
+    bool operator!=(const ItemValue& o) const { return not(*this == o); }
+
+private:
+    char buffer_[capacity + 1];
+    unsigned size_ = 0;
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+// Codes passed to the menus for keys that have no character of their own,
+// and for escape sequences that could not be decoded. They are kept apart
+// from Menu, which inherits them, so that the EscapeSequenceDecoder can be
+// built without the Pico SDK.
+struct KeyCodes {
+    static const int FAILED_ESCAPE_SEQUENCE      = 997;
+    static const int INCOMPLETE_ESCAPE_SEQUENCE  = 998;
+    static const int UNSUPPORTED_ESCAPE_SEQUENCE = 999;
+    static const int KEY_UP                      = 1000;
+    static const int KEY_DOWN                    = 1001;
+    static const int KEY_RIGHT                   = 1002;
+    static const int KEY_LEFT                    = 1003;
+    static const int KEY_HOME                    = 1004;
+    static const int KEY_END                     = 1005;
+    static const int KEY_PAGE_UP                 = 1006;
+    static const int KEY_PAGE_DOWN               = 1007;
+    static const int KEY_INSERT                  = 1008;
+    static const int KEY_DELETE                  = 1008;
+    static const int KEY_F0                      = 1020;
+    static const int KEY_F1                      = 1021;
+    static const int KEY_F2                      = 1022;
+    static const int KEY_F3                      = 1023;
+    static const int KEY_F4                      = 1024;
+    static const int KEY_F5                      = 1025;
+    static const int KEY_F6                      = 1026;
+    static const int KEY_F7                      = 1027;
+    static const int KEY_F8                      = 1028;
+    static const int KEY_F9                      = 1029;
+    static const int KEY_F10                     = 1030;
+    static const int KEY_F11                     = 1031;
+    static const int KEY_F12                     = 1032;
+    static const int CURSOR_POSITION_REPORT      = 1100;
+};
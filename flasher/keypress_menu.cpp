@@ -7,11 +7,24 @@ namespace {
     static BuildDate build_date(__DATE__,__TIME__);
 }
 
+bool KeypressMenu::event_loop_starting(int& return_code)
+{
+    // Key presses scroll up the terminal, which the virtual screen does not
+    // track efficiently, so write to the terminal directly
+    set_virtual_screen_enabled(false);
+    return true;
+}
+
+void KeypressMenu::event_loop_finishing(int& return_code)
+{
+    set_virtual_screen_enabled(true);
+}
+
 void KeypressMenu::redraw()
 {
     cls();
     curpos(1,1);
-    puts("Type some keys (terminate with Ctrl-d)");
+    puts_raw_nonl("Type some keys (terminate with Ctrl-d)\r\n");
 }
 
 bool KeypressMenu::process_key_press(int key, int key_count, int& return_code,
@@ -21,7 +34,8 @@ bool KeypressMenu::process_key_press(int key, int key_count, int& return_code,
     char buffer[80];
     sprintf(buffer, "%c %d \\%o %d",(key<256 and isprint(key))?key:' ',key,key,key_count);
     if(escape_sequence_parameters.empty()) {
-        puts(buffer);    
+        puts_raw_nonl(buffer);
+        puts_raw_nonl("\r\n");
     } else {
         puts_raw_nonl(buffer);
         puts_raw_nonl(" (");
@@ -29,7 +43,7 @@ bool KeypressMenu::process_key_press(int key, int key_count, int& return_code,
             if(i!=0)puts_raw_nonl(", ");
             puts_raw_nonl(escape_sequence_parameters[i]);
         }
-        puts(")");
+        puts_raw_nonl(")\r\n");
     }
     return_code = 0;
     if(key == '\003') {
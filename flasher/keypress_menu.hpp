@@ -6,6 +6,8 @@ class KeypressMenu: public Menu {
 public:
     virtual ~KeypressMenu() { }
     void redraw() override;
+    bool event_loop_starting(int& return_code) override;
+    void event_loop_finishing(int& return_code) override;
     bool process_key_press(int key, int key_count, int& return_code,
         const std::vector<std::string>& escape_sequence_parameters,
         absolute_time_t& next_timer) final;
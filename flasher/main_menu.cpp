@@ -1,10 +1,22 @@
+#include <cmath>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include <hardware/clocks.h>
+#include <hardware/timer.h>
+
 #include "build_date.hpp"
+#include "rng.hpp"
 #include "menu.hpp"
 #include "main_menu.hpp"
 #include "keypress_menu.hpp"
 #include "engineering_menu.hpp"
 #include "dc_ramp_menu.hpp"
+#include "waveform_menu.hpp"
 #include "spi_test_menu.hpp"
+#include "trigger_menu.hpp"
+#include "calibration_menu.hpp"
 
 namespace {
     static BuildDate build_date(__DATE__,__TIME__);
@@ -17,12 +29,40 @@ namespace {
         puts_raw_nonl(buffer); \
     }
 
+namespace {
+    // Results are formatted with ItemValue rather than printf, so that the
+    // benchmarks do not bring floating-point printf back into the image
+    void puts_benchmark_result(const char* name, unsigned name_width, const ItemValue& result) {
+        Menu::puts_raw_nonl(name, std::max<size_t>(strlen(name), name_width), true);
+        Menu::puts_raw_nonl(" : ");
+        Menu::puts_raw_nonl(result.c_str());
+        Menu::puts_raw_nonl("\n\r");
+    }
+
+    template<typename F> void benchmark(const char* name, F sample) {
+        static const unsigned nsample = 100000;
+        volatile uint32_t sink = 0;
+        uint64_t t0 = time_us_64();
+        for(unsigned i=0; i<nsample; ++i) {
+            sink += sample();
+        }
+        uint64_t t1 = time_us_64();
+        ItemValue result;
+        result.assign_fixed((t1-t0) * (clock_get_hz(clk_sys) / 1000000) * 10 / nsample, 1)
+            .append(" cycles/call");
+        puts_benchmark_result(name, 36, result);
+    }
+}
+
 std::vector<SimpleItemValueMenu::MenuItem> MainMenu::make_menu_items() {
     std::vector<SimpleItemValueMenu::MenuItem> menu_items(MIP_NUM_ITEMS);
     menu_items.at(MIP_ENGINEERING) = {"e       : Engineering menu", 0, ""};
     menu_items.at(MIP_REBOOT)      = {"Ctrl-b  : Reboot flasher (press and hold)", 0, ""};
     menu_items.at(MIP_DC_RAMP)     = {"r       : Ramp menu", 0, ""};
+    menu_items.at(MIP_WAVEFORM)    = {"w       : Waveform menu", 0, ""};
     menu_items.at(MIP_SPI_TEST)    = {"s       : SPI test menu", 0, ""};
+    menu_items.at(MIP_TRIGGER)     = {"t       : Trigger menu", 0, ""};
+    menu_items.at(MIP_CALIBRATION) = {"c       : Amplitude calibration menu", 0, ""};
     return menu_items;
 }
 
@@ -57,6 +97,14 @@ bool MainMenu::process_key_press(int key, int key_count, int& return_code,
             this->redraw();
         }
         break;
+    case 'W': 
+    case 'w': 
+        {
+            WaveformMenu menu;
+            menu.event_loop();
+            this->redraw();
+        }
+        break;
     case 'S': 
     case 's': 
         {
@@ -65,6 +113,22 @@ bool MainMenu::process_key_press(int key, int key_count, int& return_code,
             this->redraw();
         }
         break;
+    case 'T': 
+    case 't': 
+        {
+            TriggerMenu menu;
+            menu.event_loop();
+            this->redraw();
+        }
+        break;
+    case 'C': 
+    case 'c': 
+        {
+            CalibrationMenu menu;
+            menu.event_loop();
+            this->redraw();
+        }
+        break;
     case 11: /* ctrl-K : secret keypress menu */
         {
             KeypressMenu menu;
@@ -92,7 +156,44 @@ bool MainMenu::process_key_press(int key, int key_count, int& return_code,
         WRITEVAL(item_c_);
         WRITEVAL(val_c_);
         WRITEVAL(item_dr_);
-        puts("Press ctrl-L to redraw menu...");
+        puts_raw_nonl("Press ctrl-L to redraw menu...\r\n");
+        break;
+    case 18: /* ctrl-r : secret benchmark of event generator random numbers */
+        {
+            FastRNG rng;
+            cls();
+            curpos(1,1);
+            benchmark("FastRNG::next", [&rng]() { return rng.next(); });
+            benchmark("FastRNG::uniform", [&rng]() { return rng.uniform(256); });
+            benchmark("FastRNG::exponential_q24", [&rng]() { return rng.exponential_q24(); });
+#ifdef FLASHER_BENCHMARK_BASELINES
+            benchmark("rand", []() { return uint32_t(rand()); });
+            benchmark("-log(double(rand())/double(RAND_MAX))", []() {
+                return uint32_t(-std::log(double(rand())/double(RAND_MAX)) * 1000.0); });
+#endif
+            puts_raw_nonl("Press ctrl-L to redraw menu...\r\n");
+        }
+        break;
+    case 6: /* ctrl-f : secret benchmark of menu value formatting */
+        {
+            volatile float xf = 12.5;
+            volatile int xi = 1234;
+            cls();
+            curpos(1,1);
+#ifdef FLASHER_BENCHMARK_BASELINES
+            benchmark("std::to_string(int)", [&xi]() {
+                return uint32_t(std::to_string(xi).size()); });
+            benchmark("std::to_string(float)", [&xf]() {
+                return uint32_t(std::to_string(xf).size()); });
+            benchmark("sprintf(\"%.1f Hz\")", [&xf]() {
+                char buffer[20]; return uint32_t(sprintf(buffer, "%.1f Hz", xf)); });
+#endif
+            benchmark("ItemValue::assign_int", [&xi]() {
+                ItemValue value; return value.assign_int(xi).size(); });
+            benchmark("ItemValue::assign_fixed", [&xf]() {
+                ItemValue value; return value.assign_fixed(std::lround(xf*10), 1).append(" Hz").size(); });
+            puts_raw_nonl("Press ctrl-L to redraw menu...\r\n");
+        }
         break;
 
     default:
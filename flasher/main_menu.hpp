@@ -18,7 +18,10 @@ private:
     enum MenuItemPositions {
         MIP_ENGINEERING,
         MIP_DC_RAMP,
+        MIP_WAVEFORM,
         MIP_SPI_TEST,
+        MIP_TRIGGER,
+        MIP_CALIBRATION,
         MIP_REBOOT,
         MIP_NUM_ITEMS // MUST BE LAST ITEM IN LIST
     };
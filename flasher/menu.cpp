@@ -21,6 +21,14 @@ namespace {
 
 int Menu::screen_w_ = Menu::default_screen_width();
 int Menu::screen_h_ = Menu::default_screen_height();
+void (*Menu::background_task_)() = nullptr;
+uint64_t Menu::background_task_interval_us_ = 0;
+char Menu::output_buffer_[Menu::output_buffer_size];
+unsigned Menu::output_count_ = 0;
+Menu::ScheduledAction Menu::scheduled_actions_[Menu::max_scheduled_actions];
+unsigned Menu::num_scheduled_actions_ = 0;
+absolute_time_t Menu::transient_expiry_ = nil_time;
+VirtualScreen Menu::screen_(Menu::default_screen_height(), Menu::default_screen_width());
 
 RowAndColumnGetter::~RowAndColumnGetter()
 {
@@ -52,10 +60,129 @@ bool Menu::controller_disconnected(int& return_code)
     return true;
 }
 
+void Menu::set_screen_size(int h, int w)
+{
+    // Lay the menus out within the virtual screen, so that it can be used
+    // whatever the size of the terminal
+    h = std::min(h, VirtualScreen::max_height);
+    w = std::min(w, VirtualScreen::max_width);
+    if(h != screen_h_ or w != screen_w_) {
+        flush_output();
+        screen_h_ = h;
+        screen_w_ = w;
+        screen_.set_size(h, w);
+    }
+}
+
+void Menu::set_virtual_screen_enabled(bool enabled)
+{
+    flush_output();
+    screen_.set_enabled(enabled);
+}
+
+bool Menu::schedule_action(uint64_t delay_us, DeferredAction action, Menu* owner)
+{
+    if(num_scheduled_actions_ == max_scheduled_actions) {
+        return false;
+    }
+    scheduled_actions_[num_scheduled_actions_++] =
+        { make_timeout_time_us(delay_us), action, owner };
+    return true;
+}
+
+void Menu::cancel_actions(Menu* owner)
+{
+    unsigned j = 0;
+    for(unsigned i=0; i<num_scheduled_actions_; ++i) {
+        if(scheduled_actions_[i].owner != owner) {
+            scheduled_actions_[j++] = scheduled_actions_[i];
+        }
+    }
+    num_scheduled_actions_ = j;
+}
+
+void Menu::run_scheduled_actions()
+{
+    unsigned i = 0;
+    while(i<num_scheduled_actions_) {
+        ScheduledAction& a = scheduled_actions_[i];
+        if((a.owner == nullptr or a.owner == this) and time_reached(a.time)) {
+            ScheduledAction due = a;
+            a = scheduled_actions_[--num_scheduled_actions_];
+            due.action(due.owner ? due.owner : this);
+            // The action may have scheduled or cancelled others
+            i = 0;
+        } else {
+            ++i;
+        }
+    }
+}
+
+absolute_time_t Menu::next_scheduled_action_time(absolute_time_t t)
+{
+    for(unsigned i=0; i<num_scheduled_actions_; ++i) {
+        const ScheduledAction& a = scheduled_actions_[i];
+        if((a.owner == nullptr or a.owner == this) and absolute_time_diff_us(a.time, t) > 0) {
+            t = a.time;
+        }
+    }
+    return t;
+}
+
+void Menu::show_transient(int r, int c, const std::string& text,
+    bool do_highlight, uint64_t duration_us)
+{
+    if(screen_.active()) {
+        screen_.set_overlay(r-1, c-1, text.c_str(), text.size(), do_highlight);
+        transient_expiry_ = make_timeout_time_us(duration_us);
+        schedule_action(duration_us, [](Menu*) {
+            // Leave a later message up for its full duration
+            if(time_reached(transient_expiry_)) {
+                screen_.clear_overlay();
+            }
+        }, nullptr);
+    } else {
+        // Without the virtual screen the cells underneath are not known, so
+        // the menu is drawn again over the message when it expires
+        curpos(r, c);
+        if(do_highlight)highlight();
+        puts_raw_nonl(text);
+        if(do_highlight)reset_colors();
+        transient_expiry_ = make_timeout_time_us(duration_us);
+        schedule_action(duration_us, [](Menu* menu) {
+            if(time_reached(transient_expiry_)) {
+                menu->redraw();
+            }
+        }, nullptr);
+    }
+}
+
+void Menu::flush_output()
+{
+    screen_.render(putchar_direct);
+    write_output_buffer();
+}
+
+void Menu::write_output_buffer()
+{
+    if(output_count_) {
+        stdio_put_string(output_buffer_, output_count_, false, false);
+        output_count_ = 0;
+    }
+}
+
+int Menu::puts_direct(const char* s)
+{
+    for (size_t i = 0; s[i]; ++i) {
+        if (putchar_direct(s[i]) == EOF) return EOF;
+    }
+    return 0;
+}
+
 int Menu::puts_raw_nonl(const char* s) 
 {
     for (size_t i = 0; s[i]; ++i) {
-        if (putchar_raw(s[i]) == EOF) return EOF;
+        if (putchar_buffered(s[i]) == EOF) return EOF;
     }
     return 0;
 }
@@ -63,11 +190,11 @@ int Menu::puts_raw_nonl(const char* s)
 int Menu::puts_raw_nonl(const char* s, size_t maxchars, bool fill) 
 {
     for (size_t i = 0; s[i] && maxchars; ++i, --maxchars) {
-        if (putchar_raw(s[i]) == EOF) return EOF;
+        if (putchar_buffered(s[i]) == EOF) return EOF;
     }
     if(fill && maxchars) {
         while(maxchars--) {
-            if (putchar_raw(' ') == EOF) return EOF;
+            if (putchar_buffered(' ') == EOF) return EOF;
         }
     }
     return 0;
@@ -75,7 +202,7 @@ int Menu::puts_raw_nonl(const char* s, size_t maxchars, bool fill)
 
 int Menu::puts_raw_nonl(const std::string& s) {
     for (size_t i=0; i<s.size(); ++i) {
-        if (putchar_raw(s[i]) == EOF) return EOF;
+        if (putchar_buffered(s[i]) == EOF) return EOF;
     }
     return 0;
 }
@@ -84,33 +211,33 @@ int Menu::puts_raw_nonl(const std::string& s, size_t maxchars, bool fill)
 {
     size_t schars = std::min(maxchars, s.size());
     for (size_t i=0; i<schars; ++i, --maxchars) {
-        if (putchar_raw(s[i]) == EOF) return EOF;
+        if (putchar_buffered(s[i]) == EOF) return EOF;
     }
     if(fill && maxchars) {
         while(maxchars--) {
-            if (putchar_raw(' ') == EOF) return EOF;
+            if (putchar_buffered(' ') == EOF) return EOF;
         }
     }
     return 0;
 }
 
-int Menu::puts_formatted(const std::string& s, const std::string& format, 
+int Menu::puts_formatted(const char* s, const char* format,
     size_t maxchars, bool fill)
 {
-    size_t schars = std::min(maxchars, s.size());
-    if(!format.empty()) {
+    size_t schars = std::min(maxchars, strlen(s));
+    if(*format) {
         if(puts_raw_nonl("\0337") == EOF or puts_raw_nonl(format) == EOF)
             return EOF;
     }
     for (size_t i=0; i<schars; ++i, --maxchars) {
-        if (putchar_raw(s[i]) == EOF) return EOF;
+        if (putchar_buffered(s[i]) == EOF) return EOF;
     }
     if(fill && maxchars) {
         while(maxchars--) {
-            if (putchar_raw(' ') == EOF) return EOF;
+            if (putchar_buffered(' ') == EOF) return EOF;
         }
     }
-    if(!format.empty()) {
+    if(*format) {
         if (puts_raw_nonl("\0338") == EOF)return EOF;
     }
     return 0;
@@ -121,17 +248,25 @@ int Menu::puts_center_filled(const std::string& s, size_t maxchars, char fill_ch
     size_t schars = std::min(maxchars, s.size());
     size_t fchars = (maxchars-schars)/2;
     for (size_t i=0; i<fchars; ++i, --maxchars) {
-        if (putchar_raw(fill_char) == EOF) return EOF;
+        if (putchar_buffered(fill_char) == EOF) return EOF;
     }
     for (size_t i=0; i<schars; ++i, --maxchars) {
-        if (putchar_raw(s[i]) == EOF) return EOF;
+        if (putchar_buffered(s[i]) == EOF) return EOF;
     }
     while(maxchars--) {
-        if (putchar_raw(fill_char) == EOF) return EOF;
+        if (putchar_buffered(fill_char) == EOF) return EOF;
     }
     return 0;
 }
 
+std::string Menu::center_filled(const std::string& s, size_t maxchars, char fill_char)
+{
+    size_t schars = std::min(maxchars, s.size());
+    size_t fchars = (maxchars-schars)/2;
+    std::string filled(maxchars, fill_char);
+    filled.replace(fchars, schars, s, 0, schars);
+    return filled;
+}
 
 void Menu::cls() 
 { 
@@ -140,12 +275,12 @@ void Menu::cls()
 
 void Menu::show_cursor() 
 { 
-    puts_raw_nonl("\033[?25h"); //\0337p"); 
+    puts_direct("\033[?25h"); //\0337p"); 
 }
 
 void Menu::hide_cursor() 
 { 
-    puts_raw_nonl("\033[?25l"); //\0336p"); 
+    puts_direct("\033[?25l"); //\0336p"); 
 }
 
 void Menu::curpos(int r, int c) 
@@ -177,29 +312,29 @@ void Menu::reset_colors()
 
 void Menu::send_request_screen_size() 
 {
-    puts_raw_nonl("\0337\033[999;999H\033[6n\0338");
+    puts_direct("\0337\033[999;999H\033[6n\0338");
 }
 
 void Menu::beep()
 {
-    putchar_raw(7);
+    putchar_direct(7);
 }
 
 void Menu::draw_box(int fh, int fw, int fr, int fc) {
     curpos(fr+1,fc+1);
-    putchar_raw('+');
-    for(int ic=2;ic<fw;++ic)putchar_raw('-');
-    putchar_raw('+');
+    putchar_buffered('+');
+    for(int ic=2;ic<fw;++ic)putchar_buffered('-');
+    putchar_buffered('+');
     for(int ir=2;ir<fh;++ir) {
         curpos(fr+ir,fc+1);
-        putchar_raw('|');
-        for(int ic=2;ic<fw;++ic)putchar_raw(' ');
-        putchar_raw('|');
+        putchar_buffered('|');
+        for(int ic=2;ic<fw;++ic)putchar_buffered(' ');
+        putchar_buffered('|');
     }
     curpos(fr+fh,fc+1);
-    putchar_raw('+');
-    for(int ic=2;ic<fw;++ic)putchar_raw('-');
-    putchar_raw('+');
+    putchar_buffered('+');
+    for(int ic=2;ic<fw;++ic)putchar_buffered('-');
+    putchar_buffered('+');
 }
 
 bool Menu::draw_title(const std::string& title, int fh, int fw, int fr, int fc,
@@ -257,9 +392,9 @@ bool Menu::process_rc_keys(int& ar, int& ac, int key, int key_count)
     return false;
 }
 
-void Menu::rc_to_value_string(std::string& value, int ar, int ac)
+void Menu::rc_to_value_string(ItemValue& value, int ar, int ac)
 {
-    value = std::string(1, char('A' + ar)) + std::to_string(ac); 
+    value.assign(char('A' + ar)).append_int(ac);
 }
 
 FramedMenu::FramedMenu(const std::string& title, int frame_h, int frame_w, int frame_pos, uint64_t timer_interval_us):
@@ -316,7 +451,7 @@ void FramedMenu::setup_frame()
 }
 
 SimpleItemValueMenu::MenuItem::
-MenuItem(const std::string& item_, int max_value_size_, const std::string& value_):
+MenuItem(const std::string& item_, int max_value_size_, const char* value_):
     item(item_), max_value_size(max_value_size_), value(value_)
 { 
     // nothing to see here
@@ -380,10 +515,10 @@ void SimpleItemValueMenu::draw_item(unsigned iitem)
     curpos(item_r_+iitem*item_dr_+1, item_c_+1);
     if(menu_items_[iitem].max_value_size > 0) {
         puts_raw_nonl(menu_items_[iitem].item, item_w_);
-        putchar_raw(' ');
+        putchar_buffered(' ');
         for(int ic = item_c_+menu_items_[iitem].item.size()+2; ic<val_c_; ic ++)
-            putchar_raw('.');
-        putchar_raw(' ');
+            putchar_buffered('.');
+        putchar_buffered(' ');
         draw_item_value(iitem);
     } else {
         puts_raw_nonl(menu_items_[iitem].item, item_w_+val_w_+2);
@@ -394,11 +529,11 @@ void SimpleItemValueMenu::draw_item_value(unsigned iitem)
 {
     if(iitem<menu_items_.size()) {
         curpos(item_r_+iitem*item_dr_+1, val_c_+1);
-        if(!menu_items_[iitem].value_style.empty()) {
-            puts_formatted(menu_items_[iitem].value, menu_items_[iitem].value_style, 
+        if(*menu_items_[iitem].value_style) {
+            puts_formatted(menu_items_[iitem].value.c_str(), menu_items_[iitem].value_style,
                 menu_items_[iitem].max_value_size, true);
         } else {
-            puts_raw_nonl(menu_items_[iitem].value, menu_items_[iitem].max_value_size, true);
+            puts_raw_nonl(menu_items_[iitem].value.c_str(), menu_items_[iitem].max_value_size, true);
         }
     }
 }
@@ -5,6 +5,10 @@
 
 #include <pico/time.h>
 
+#include "item_value.hpp"
+#include "key_codes.hpp"
+#include "virtual_screen.hpp"
+
 #define ANSI_INVERT "\033[7m"
 
 class RowAndColumnGetter {
@@ -14,7 +18,7 @@ public:
     virtual int col() = 0;
 };
 
-class Menu {
+class Menu: public KeyCodes {
 public:
     Menu(uint64_t timer_interval_us = default_timer_interval_us()) :
         timer_interval_us_(timer_interval_us) { }
@@ -36,17 +40,70 @@ public:
     uint64_t timer_interval_us() const { return timer_interval_us_; }
     int screen_width() const { return screen_w_; }
     int screen_height() const { return screen_h_; }
-    static void set_screen_size(int h, int w) { screen_h_ = h; screen_w_ = w; }
-
+    static void set_screen_size(int h, int w);
+
+    // Work to be done on this core in between handling keys and timers, such
+    // as generating events for the dispatcher. While a task is set the event
+    // loop waits no longer than "interval_us" for a key before running it.
+    static void set_background_task(void (*task)(), uint64_t interval_us) {
+        background_task_ = task; background_task_interval_us_ = interval_us; }
+    static void clear_background_task() { background_task_ = nullptr; }
+
+    // Terminal output is collected in a buffer and written to stdio in large
+    // chunks, rather than one character at a time through the stdio driver
+    // chain. The event loop flushes it before waiting for a key, anything
+    // that blocks or writes to stdio directly must flush it first.
+    //
+    // While the virtual screen is active the menus draw into it rather than
+    // into the buffer, and flushing sends the terminal only the cells that
+    // have changed since the last flush. Sequences that are not drawing,
+    // such as the screen size request, bypass it with putchar_direct().
+    static int putchar_buffered(int c) {
+        if(screen_.active()) {
+            screen_.put(c);
+            return c;
+        }
+        return putchar_direct(c);
+    }
+    static int putchar_direct(int c) {
+        if(output_count_ == output_buffer_size) { write_output_buffer(); }
+        output_buffer_[output_count_++] = c;
+        return c;
+    }
+    static void flush_output();
+
+    // Menus that scroll text past the bottom of the screen should write to
+    // the terminal directly. Ctrl-L and reconnecting invalidate the screen,
+    // so the next flush clears the terminal and draws everything again.
+    static void set_virtual_screen_enabled(bool enabled);
+    static void invalidate_screen() { screen_.invalidate(); }
+
+    // Actions that the event loop runs once their time has come, so menus
+    // can undo transient feedback without sleeping, which would stall the
+    // timers and background tasks of every menu. An action runs only in the
+    // event loop of its owner, or in any loop if the owner is null, and is
+    // dropped when the owner's event loop finishes. The action is passed its
+    // owner, or the menu whose event loop runs it if it has none.
+    typedef void (*DeferredAction)(Menu* owner);
+    static bool schedule_action(uint64_t delay_us, DeferredAction action, Menu* owner);
+    static void cancel_actions(Menu* owner);
+
+    // Show a message over the screen for a while, after which whatever is
+    // underneath reappears. Row and column count from one, as in curpos().
+    static void show_transient(int r, int c, const std::string& text,
+        bool do_highlight, uint64_t duration_us);
+
+    static int puts_direct(const char* s);
     static int puts_raw_nonl(const char* s);
     static int puts_raw_nonl(const char* s, size_t maxchars, bool fill = false);
     static int puts_raw_nonl(const std::string& s);
     static int puts_raw_nonl(const std::string& s, size_t maxchars, bool fill = false);
 
-    static int puts_formatted(const std::string& s, const std::string& format, 
+    static int puts_formatted(const char* s, const char* format,
         size_t maxchars, bool fill = false);
 
     static int puts_center_filled(const std::string& s, size_t maxchars, char fill_char = ' ');
+    static std::string center_filled(const std::string& s, size_t maxchars, char fill_char = ' ');
 
     static int default_screen_width() { return 80; }
     static int default_screen_height() { return 24; }
@@ -95,44 +152,37 @@ public:
     }
 
     static bool process_rc_keys(int& ar, int& ac, int key, int key_count);
-    static void rc_to_value_string(std::string& value, int ar, int ac);
-
-    static const int FAILED_ESCAPE_SEQUENCE      = 997;
-    static const int INCOMPLETE_ESCAPE_SEQUENCE  = 998;
-    static const int UNSUPPORTED_ESCAPE_SEQUENCE = 999;
-    static const int KEY_UP                      = 1000;
-    static const int KEY_DOWN                    = 1001;
-    static const int KEY_RIGHT                   = 1002;
-    static const int KEY_LEFT                    = 1003;
-    static const int KEY_HOME                    = 1004;
-    static const int KEY_END                     = 1005;
-    static const int KEY_PAGE_UP                 = 1006;
-    static const int KEY_PAGE_DOWN               = 1007;
-    static const int KEY_INSERT                  = 1008;
-    static const int KEY_DELETE                  = 1008;
-    static const int KEY_F0                      = 1020;
-    static const int KEY_F1                      = 1021;
-    static const int KEY_F2                      = 1022;
-    static const int KEY_F3                      = 1023;
-    static const int KEY_F4                      = 1024;
-    static const int KEY_F5                      = 1025;
-    static const int KEY_F6                      = 1026;
-    static const int KEY_F7                      = 1027;
-    static const int KEY_F8                      = 1028;
-    static const int KEY_F9                      = 1029;
-    static const int KEY_F10                     = 1030;
-    static const int KEY_F11                     = 1031;
-    static const int KEY_F12                     = 1032;
-    static const int CURSOR_POSITION_REPORT      = 1100;
+    static void rc_to_value_string(ItemValue& value, int ar, int ac);
 
 protected:
     uint64_t timer_interval_us_   = default_timer_interval_us();
     static int screen_w_;
     static int screen_h_;
+    static void (*background_task_)();
+    static uint64_t background_task_interval_us_;
+
+    struct ScheduledAction {
+        absolute_time_t time;
+        DeferredAction action;
+        Menu* owner;
+    };
+    static const unsigned max_scheduled_actions = 8;
+    static ScheduledAction scheduled_actions_[max_scheduled_actions];
+    static unsigned num_scheduled_actions_;
+    static absolute_time_t transient_expiry_;
+
+    static const unsigned output_buffer_size = 1024;
+    static char output_buffer_[output_buffer_size];
+    static unsigned output_count_;
+    static VirtualScreen screen_;
 
 private:
-    static int decode_partial_escape_sequence(int key, std::string& escape_sequence, 
-        std::vector<std::string>& escape_sequence_parameters);
+    static void write_output_buffer();
+    static void chars_available_callback(void*);
+    static int getchar_or_wait_until(absolute_time_t until);
+    void run_scheduled_actions();
+    absolute_time_t next_scheduled_action_time(absolute_time_t t);
+    static uint64_t connection_poll_interval_us() { return 10000; }
 };
 
 class FramedMenu: public Menu
@@ -167,12 +217,12 @@ protected:
 class SimpleItemValueMenu: public FramedMenu {
 public:
     struct MenuItem {
-        MenuItem(): item(), max_value_size(), value(), value_style() {}
-        MenuItem(const std::string& item_, int max_value_size_, const std::string& value_={});
+        MenuItem(): item(), max_value_size(), value() {}
+        MenuItem(const std::string& item_, int max_value_size_, const char* value_ = "");
         std::string item;
         int max_value_size;
-        std::string value;
-        std::string value_style = {};
+        ItemValue value;
+        const char* value_style = "";
     };
 
     SimpleItemValueMenu(const std::vector<MenuItem>& menu_items, 
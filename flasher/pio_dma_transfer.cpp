@@ -0,0 +1,92 @@
+#include <hardware/pio.h>
+#include <hardware/dma.h>
+
+#include "build_date.hpp"
+#include "pio_dma_transfer.hpp"
+
+namespace {
+    static BuildDate build_date(__DATE__,__TIME__);
+}
+
+void PIODMATransfer::claim(PIO pio, const pio_program_t* program)
+{
+    pio_ = pio;
+    program_ = program;
+    offset_ = pio_add_program(pio_, program_);
+    sm_ = pio_claim_unused_sm(pio_, true);
+}
+
+dma_channel_config PIODMATransfer::data_config()
+{
+    dma_channel_config config = dma_channel_get_default_config(data_chan_);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_32);
+    channel_config_set_read_increment(&config, true);
+    channel_config_set_write_increment(&config, false);
+    channel_config_set_dreq(&config, pio_get_dreq(pio_, sm_, true));
+    return config;
+}
+
+void PIODMATransfer::start_once(const uint32_t* words, unsigned nword)
+{
+    pio_sm_put(pio_, sm_, words[0]);
+    data_chan_ = dma_claim_unused_channel(true);
+    dma_channel_config config = data_config();
+    dma_channel_configure(data_chan_, &config, &pio_->txf[sm_], words+1, nword-1, nword>1);
+    pio_->fdebug = 1u << (PIO_FDEBUG_TXSTALL_LSB + sm_);
+    pio_sm_set_enabled(pio_, sm_, true);
+}
+
+void PIODMATransfer::start_looped(const uint32_t* words, unsigned nword,
+    const uint32_t* const* restart_table, bool step_table)
+{
+    // The control channel runs once at the end of each pass, writing the
+    // next read address into the data channel, which retriggers it. A null
+    // address ends the chain.
+    data_chan_ = dma_claim_unused_channel(true);
+    control_chan_ = dma_claim_unused_channel(true);
+
+    dma_channel_config control_config = dma_channel_get_default_config(control_chan_);
+    channel_config_set_transfer_data_size(&control_config, DMA_SIZE_32);
+    channel_config_set_read_increment(&control_config, step_table);
+    channel_config_set_write_increment(&control_config, false);
+    dma_channel_configure(control_chan_, &control_config,
+        &dma_hw->ch[data_chan_].al3_read_addr_trig, restart_table, 1, false);
+
+    dma_channel_config config = data_config();
+    channel_config_set_chain_to(&config, control_chan_);
+    pio_->fdebug = 1u << (PIO_FDEBUG_TXSTALL_LSB + sm_);
+    dma_channel_configure(data_chan_, &config, &pio_->txf[sm_], words, nword, true);
+    pio_sm_set_enabled(pio_, sm_, true);
+}
+
+bool PIODMATransfer::is_finished()
+{
+    return not dma_channel_is_busy(data_chan_)
+        and (control_chan_ < 0 or not dma_channel_is_busy(control_chan_))
+        and pio_sm_is_tx_fifo_empty(pio_, sm_)
+        and (pio_->fdebug & (1u << (PIO_FDEBUG_TXSTALL_LSB + sm_)));
+}
+
+void PIODMATransfer::release()
+{
+    if(control_chan_ >= 0) {
+        // Break the chain before aborting, otherwise aborting the data
+        // channel can trigger the control channel
+        dma_channel_config config = data_config();
+        channel_config_set_chain_to(&config, data_chan_);
+        channel_config_set_enable(&config, false);
+        dma_channel_set_config(data_chan_, &config, false);
+        dma_channel_abort(control_chan_);
+        dma_channel_unclaim(control_chan_);
+        control_chan_ = -1;
+    }
+    if(data_chan_ >= 0) {
+        dma_channel_abort(data_chan_);
+        dma_channel_unclaim(data_chan_);
+        data_chan_ = -1;
+    }
+    pio_sm_set_enabled(pio_, sm_, false);
+    pio_sm_clear_fifos(pio_, sm_);
+    pio_sm_unclaim(pio_, sm_);
+    pio_remove_program(pio_, program_, offset_);
+}
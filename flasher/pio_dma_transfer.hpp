@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+
+#include <hardware/pio.h>
+
+// Feeds a table of words to a PIO state machine by DMA, for the engines that
+// drive pins in hardware from a table built by the CPU. One-shot transfers
+// send the table once. Their first word is queued before the state machine
+// is enabled, so it stalls on the empty FIFO only after the last word has
+// been taken, which is how is_finished() knows the transfer is done. Looped
+// transfers add a control channel, which writes a new read address into the
+// data channel at the end of each pass and so restarts it without the CPU.
+class PIODMATransfer
+{
+public:
+    // Load the program and claim a state machine to run it. The caller then
+    // initialises the state machine with the program's init function.
+    void claim(PIO pio, const pio_program_t* program);
+
+    // Send the words once
+    void start_once(const uint32_t* words, unsigned nword);
+
+    // Send the words, and then from each address of "restart_table" in turn
+    // until one is null, or from its first address forever if "step_table"
+    // is false
+    void start_looped(const uint32_t* words, unsigned nword,
+        const uint32_t* const* restart_table, bool step_table);
+
+    // True once all the words have been sent and the state machine is
+    // stalled waiting for more
+    bool is_finished();
+
+    // Stop the transfer and free the DMA channels, state machine and program
+    void release();
+
+    PIO pio() const { return pio_; }
+    uint sm() const { return sm_; }
+    uint offset() const { return offset_; }
+
+private:
+    dma_channel_config data_config();
+
+    PIO pio_ = nullptr;
+    const pio_program_t* program_ = nullptr;
+    uint sm_ = 0;
+    uint offset_ = 0;
+    int data_chan_ = -1;
+    int control_chan_ = -1;
+};
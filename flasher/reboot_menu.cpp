@@ -32,8 +32,8 @@ void RebootMenu::redraw()
     FramedMenu::redraw();
     curpos(frame_r_+5, frame_c_+4);
     puts_raw_nonl("Hold ctrl-b to reboot : ");
-    for(int i=0;i<dots_;++i)putchar_raw('X');
-    for(int i=dots_;i<10;++i)putchar_raw('_');
+    for(int i=0;i<dots_;++i)putchar_buffered('X');
+    for(int i=dots_;i<10;++i)putchar_buffered('_');
 }
 
 bool RebootMenu::process_key_press(int key, int key_count, int& return_code, 
@@ -43,18 +43,18 @@ bool RebootMenu::process_key_press(int key, int key_count, int& return_code,
     if(key == '\002') {
         ++dots_;
         curpos(frame_r_+5, frame_c_+28);
-        for(int i=0;i<dots_;++i)putchar_raw('X');
-        for(int i=dots_;i<10;++i)putchar_raw('_');
+        for(int i=0;i<dots_;++i)putchar_buffered('X');
+        for(int i=dots_;i<10;++i)putchar_buffered('_');
         if(dots_ >= 10) {
+            flush_output();
             watchdog_enable(1,false);
             while(1);
         }
         timer_calls_ = 0;
         return true;
     } else {
-        curpos(frame_r_+5, frame_c_+ 4);
-        puts_center_filled("  CANCELLED  ", frame_w_-6,'X');
-        sleep_ms(1000);
+        show_transient(frame_r_+5, frame_c_+4, center_filled("  CANCELLED  ", frame_w_-6, 'X'),
+            false, cancelled_display_us());
         return_code = 0;
         return false;
     }
@@ -70,9 +70,8 @@ bool RebootMenu::process_timer(bool controller_is_connected, int& return_code,
 {
     if(not controller_is_connected or timer_calls_>100)
     {
-        curpos(frame_r_+5, frame_c_+ 4);
-        puts_center_filled("  CANCELLED  ", frame_w_-6,'X');
-        sleep_ms(1000);
+        show_transient(frame_r_+5, frame_c_+4, center_filled("  CANCELLED  ", frame_w_-6, 'X'),
+            false, cancelled_display_us());
         return_code = 0;
         return false;
     }
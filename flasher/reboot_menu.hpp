@@ -14,6 +14,8 @@ public:
     bool process_timer(bool controller_is_connected, int& return_code,
         absolute_time_t& next_timer) override;
 private:
+    static uint64_t cancelled_display_us() { return 1000000; }
+
     Menu* base_menu_ = nullptr;
     int dots_ = 0;
     int timer_calls_ = 0;
@@ -0,0 +1,101 @@
+#include <pico/rand.h>
+
+#include "build_date.hpp"
+#include "rng.hpp"
+
+namespace {
+    static BuildDate build_date(__DATE__,__TIME__);
+
+    // -ln(0.5 + i/512) for i=0..256 in Q8.24
+    static const uint32_t minus_ln_table[257] = {
+        11629080, 11563672, 11498517, 11433615, 11368963, 11304559,
+        11240401, 11176488, 11112817, 11049387, 10986196, 10923242,
+        10860523, 10798038, 10735785, 10673762, 10611968, 10550400,
+        10489057, 10427938, 10367040, 10306363, 10245905, 10185663,
+        10125637, 10065826, 10006226,  9946838,  9887659,  9828688,
+         9769923,  9711364,  9653009,  9594855,  9536903,  9479150,
+         9421595,  9364237,  9307074,  9250106,  9193330,  9136746,
+         9080352,  9024147,  8968129,  8912298,  8856652,  8801190,
+         8745911,  8690813,  8635896,  8581158,  8526598,  8472215,
+         8418007,  8363974,  8310115,  8256428,  8202912,  8149566,
+         8096389,  8043381,  7990539,  7937863,  7885352,  7833005,
+         7780821,  7728799,  7676937,  7625235,  7573692,  7522307,
+         7471079,  7420007,  7369090,  7318326,  7267716,  7217259,
+         7166952,  7116796,  7066789,  7016931,  6967221,  6917657,
+         6868240,  6818968,  6769840,  6720855,  6672013,  6623313,
+         6574754,  6526334,  6478055,  6429913,  6381910,  6334043,
+         6286313,  6238718,  6191258,  6143931,  6096738,  6049677,
+         6002748,  5955949,  5909281,  5862742,  5816332,  5770050,
+         5723895,  5677867,  5631965,  5586188,  5540536,  5495008,
+         5449602,  5404320,  5359159,  5314120,  5269201,  5224402,
+         5179722,  5135161,  5090718,  5046392,  5002184,  4958091,
+         4914114,  4870252,  4826504,  4782870,  4739350,  4695942,
+         4652646,  4609461,  4566387,  4523424,  4480570,  4437826,
+         4395190,  4352662,  4310242,  4267928,  4225721,  4183620,
+         4141625,  4099734,  4057948,  4016265,  3974686,  3933210,
+         3891835,  3850563,  3809392,  3768322,  3727352,  3686481,
+         3645710,  3605038,  3564465,  3523989,  3483610,  3443329,
+         3403144,  3363055,  3323062,  3283163,  3243360,  3203650,
+         3164035,  3124512,  3085083,  3045746,  3006501,  2967348,
+         2928285,  2889314,  2850433,  2811642,  2772940,  2734327,
+         2695803,  2657367,  2619019,  2580759,  2542585,  2504499,
+         2466498,  2428583,  2390754,  2353010,  2315351,  2277776,
+         2240285,  2202878,  2165553,  2128312,  2091153,  2054076,
+         2017082,  1980168,  1943335,  1906584,  1869912,  1833320,
+         1796809,  1760376,  1724022,  1687747,  1651550,  1615431,
+         1579390,  1543426,  1507539,  1471729,  1435994,  1400336,
+         1364753,  1329246,  1293814,  1258456,  1223173,  1187963,
+         1152828,  1117766,  1082777,  1047861,  1013017,   978245,
+          943546,   908918,   874361,   839876,   805461,   771117,
+          736842,   702638,   668503,   634438,   600442,   566514,
+          532655,   498864,   465141,   431485,   397897,   364376,
+          330922,   297535,   264214,   230958,   197769,   164645,
+          131587,    98593,    65664,    32800,        0
+    };
+
+    static const uint32_t ln2_q24 = 11629080;
+}
+
+FastRNG::FastRNG()
+{
+    // ROSC (and TRNG on the RP2350) based entropy from the SDK
+    set_seed(get_rand_64());
+}
+
+void FastRNG::set_seed(uint64_t seed)
+{
+    // Expand the seed into the state with splitmix64, which cannot produce
+    // the all-zero state from a single seed
+    for(unsigned i=0; i<2; ++i) {
+        seed += 0x9E3779B97F4A7C15ULL;
+        uint64_t z = seed;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        z = z ^ (z >> 31);
+        s_[2*i] = uint32_t(z);
+        s_[2*i+1] = uint32_t(z >> 32);
+    }
+}
+
+uint32_t FastRNG::exponential_q24()
+{
+    // -ln(u) for uniform u, computed as the number of leading zeros of u
+    // times ln(2), plus -ln of the normalised mantissa from the table with
+    // linear interpolation. A zero u has probability 2^-32 : since the
+    // distribution is memoryless, add 32*ln(2) and draw again.
+    uint32_t offset = 0;
+    uint32_t u = next();
+    while(u == 0) {
+        if(offset >= 0xFFFFFFFFU - 2*32*ln2_q24) {
+            return 0xFFFFFFFFU;
+        }
+        offset += 32*ln2_q24;
+        u = next();
+    }
+    uint32_t lz = __builtin_clz(u);
+    uint32_t m = u << lz;
+    uint32_t i = (m >> 23) & 0xFF;
+    uint32_t t = (m >> 7) & 0xFFFF;
+    uint32_t d = minus_ln_table[i] - minus_ln_table[i+1];
+    return offset + lz*ln2_q24 + minus_ln_table[i] - ((d * t) >> 16);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+
+// Fast pseudo-random number generator for the event generators, using
+// xoshiro128** (see https://prng.di.unimi.it/) seeded from the hardware
+// entropy sources, with an exponential sampler that uses only integer
+// arithmetic and a small table. An instance must only be used on one core.
+class FastRNG {
+public:
+    FastRNG();
+    FastRNG(uint64_t seed) { set_seed(seed); }
+
+    void set_seed(uint64_t seed);
+
+    inline uint32_t next() {
+        const uint32_t result = rotl(s_[1] * 5, 7) * 9;
+        const uint32_t t = s_[1] << 9;
+        s_[2] ^= s_[0];
+        s_[3] ^= s_[1];
+        s_[1] ^= s_[2];
+        s_[0] ^= s_[3];
+        s_[2] ^= t;
+        s_[3] = rotl(s_[3], 11);
+        return result;
+    }
+
+    // Uniform integer in [0, n)
+    inline uint32_t uniform(uint32_t n) {
+        return (uint64_t(next()) * n) >> 32;
+    }
+
+    // Exponentially distributed value with unit mean, as unsigned Q8.24
+    // fixed point, saturating at 256
+    uint32_t exponential_q24();
+
+    static constexpr uint32_t q24_one() { return 1U << 24; }
+
+private:
+    static inline uint32_t rotl(uint32_t x, int k) {
+        return (x << k) | (x >> (32 - k));
+    }
+
+    uint32_t s_[4];
+};
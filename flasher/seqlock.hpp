@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// Single-writer sequence lock used to hand a block of parameters from the
+// menu core to the dispatcher core. The writer never waits, and the reader
+// only retries if it catches the writer part way through copying the block,
+// so neither core can stall the other. A reader always sees a complete block
+// as it was published, never a mixture of old and new fields.
+template<typename T> class SeqLock {
+public:
+    static_assert(std::is_trivially_copyable<T>::value,
+        "SeqLock can only hold trivially copyable types");
+
+    SeqLock(const T& value = {}): value_(value) { }
+
+    void publish(const T& value) {
+        uint32_t seq = seq_.load(std::memory_order_relaxed);
+        seq_.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(&value_, &value, sizeof(T));
+        seq_.store(seq + 2, std::memory_order_release);
+    }
+
+    // Copy the block into "value" if it has been published since "seq" was
+    // last updated by this function. Returns true if "value" was changed.
+    bool read_if_changed(T& value, uint32_t& seq) const {
+        uint32_t seq0 = seq_.load(std::memory_order_acquire);
+        while(seq0 != seq) {
+            if((seq0 & 1) == 0) {
+                T copy;
+                std::memcpy(&copy, &value_, sizeof(T));
+                std::atomic_thread_fence(std::memory_order_acquire);
+                uint32_t seq1 = seq_.load(std::memory_order_relaxed);
+                if(seq1 == seq0) {
+                    value = copy;
+                    seq = seq0;
+                    return true;
+                }
+                seq0 = seq1;
+            } else {
+                seq0 = seq_.load(std::memory_order_acquire);
+            }
+        }
+        return false;
+    }
+
+    // Sequence number that is never published, for readers that have not
+    // yet seen any value
+    static uint32_t unread_seq() { return 0xFFFFFFFFU; }
+
+private:
+    std::atomic<uint32_t> seq_ { 0 };
+    T value_;
+};
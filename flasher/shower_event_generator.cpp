@@ -0,0 +1,538 @@
+#include <cmath>
+#include <algorithm>
+
+#include "build_date.hpp"
+#include "shower_event_generator.hpp"
+#include "event_dispatcher.hpp"
+
+namespace {
+    static BuildDate build_date(__DATE__,__TIME__);
+    static const float pi = 3.14159265f;
+    static const float muon_ring_width = 0.6f; // gaussian sigma in pixels
+}
+
+ShowerImageEventGenerator::ShowerImageEventGenerator():
+    SimpleItemValueMenu(make_menu_items(), "Shower image event generator")
+{
+    set_freq_mode_value(false);
+    set_freq_value(false);
+    set_image_type_value(false);
+    set_width_value(false);
+    set_length_value(false);
+    set_radius_value(false);
+    set_orient_mode_value(false);
+    set_centroid_mode_value(false);
+    set_spectrum_mode_value(false);
+    set_size_value(false);
+    set_enabled_value(false);
+    published_ = make_parameters();
+    parameters_.publish(published_);
+}
+
+ShowerImageEventGenerator::~ShowerImageEventGenerator()
+{
+    // nothing to see here
+}
+
+std::vector<SimpleItemValueMenu::MenuItem> ShowerImageEventGenerator::make_menu_items()
+{
+    std::vector<SimpleItemValueMenu::MenuItem> menu_items(MIP_NUM_ITEMS);
+    menu_items.at(MIP_FREQ_MODE)     = {"F       : Set image frequency mode (Poisson/Periodic)", 8, "Periodic"};
+    menu_items.at(MIP_FREQ)          = {"+/-     : Increase/decrease image frequency", 10, "100.0 Hz"};
+    menu_items.at(MIP_FREQ_DECADE)   = {"0 to 5  : Set frequency to 10^(N-1) Hz (press and hold)", 0, ""};
+    menu_items.at(MIP_IMAGE_TYPE)    = {"T       : Set image type (Ellipse/Muon ring/Mixed)", 9, "Ellipse"};
+    menu_items.at(MIP_WIDTH)         = {"W/w     : Increase/decrease ellipse width", 6, "1.0"};
+    menu_items.at(MIP_LENGTH)        = {"L/l     : Increase/decrease ellipse length", 6, "2.0"};
+    menu_items.at(MIP_RADIUS)        = {"R/r     : Increase/decrease muon ring radius", 6, "4.0"};
+    menu_items.at(MIP_ORIENT_MODE)   = {"O       : Set orientation mode (Random/Fixed)", 6, "Random"};
+    menu_items.at(MIP_ORIENT)        = {"[/]     : Rotate fixed orientation", 6, "N/A"};
+    menu_items.at(MIP_CENTROID_MODE) = {"C       : Set centroid mode (Random/Fixed)", 6, "Random"};
+    menu_items.at(MIP_CENTROID)      = {"Cursors : Change centroid column & row", 3, "N/A"};
+    menu_items.at(MIP_SPECTRUM_MODE) = {"I       : Set size spectrum (Power law/Fixed)", 9, "Fixed"};
+    menu_items.at(MIP_SIZE)          = {"</>     : Decrease/increase image size (minimum)", 5, "1000"};
+    menu_items.at(MIP_INDEX)         = {"{/}     : Decrease/increase spectral index", 4, "N/A"};
+    menu_items.at(MIP_ENABLED)       = {"S       : Start (press and hold) or stop flasher", 4, "off"};
+    return menu_items;
+}
+
+void ShowerImageEventGenerator::set_freq_mode_value(bool draw)
+{
+    if(freq_mode_ == 0) { menu_items_[MIP_FREQ_MODE].value = "Periodic"; }
+    else { menu_items_[MIP_FREQ_MODE].value = "Poisson"; }
+    if(draw)draw_item_value(MIP_FREQ_MODE);
+}
+
+void ShowerImageEventGenerator::set_freq_value(bool draw)
+{
+    menu_items_[MIP_FREQ].value.assign_fixed(std::lround(freq_*10), 1).append(" Hz");
+    if(draw)draw_item_value(MIP_FREQ);
+}
+
+void ShowerImageEventGenerator::set_image_type_value(bool draw)
+{
+    switch(image_type_) {
+        case IT_ELLIPSE: menu_items_[MIP_IMAGE_TYPE].value = "Ellipse"; break;
+        case IT_MUON: menu_items_[MIP_IMAGE_TYPE].value = "Muon ring"; break;
+        case IT_MIXED: menu_items_[MIP_IMAGE_TYPE].value = "Mixed"; break;
+    }
+    if(draw)draw_item_value(MIP_IMAGE_TYPE);
+}
+
+void ShowerImageEventGenerator::set_width_value(bool draw)
+{
+    menu_items_[MIP_WIDTH].value.assign_fixed(width_x10_, 1);
+    if(draw)draw_item_value(MIP_WIDTH);
+}
+
+void ShowerImageEventGenerator::set_length_value(bool draw)
+{
+    menu_items_[MIP_LENGTH].value.assign_fixed(length_x10_, 1);
+    if(draw)draw_item_value(MIP_LENGTH);
+}
+
+void ShowerImageEventGenerator::set_radius_value(bool draw)
+{
+    menu_items_[MIP_RADIUS].value.assign_fixed(radius_x10_, 1);
+    if(draw)draw_item_value(MIP_RADIUS);
+}
+
+void ShowerImageEventGenerator::set_orient_mode_value(bool draw)
+{
+    if(orient_mode_ == 0) { menu_items_[MIP_ORIENT_MODE].value = "Fixed"; }
+    else { menu_items_[MIP_ORIENT_MODE].value = "Random"; }
+    if(draw)draw_item_value(MIP_ORIENT_MODE);
+    set_orient_value(draw);
+}
+
+void ShowerImageEventGenerator::set_orient_value(bool draw)
+{
+    if(orient_mode_ == 0) {
+        menu_items_[MIP_ORIENT].value.assign_fixed(std::lround(orient_*1800.0/num_orientations), 1);
+    } else {
+        menu_items_[MIP_ORIENT].value = "N/A";
+    }
+    if(draw)draw_item_value(MIP_ORIENT);
+}
+
+void ShowerImageEventGenerator::set_centroid_mode_value(bool draw)
+{
+    if(centroid_mode_ == 0) { menu_items_[MIP_CENTROID_MODE].value = "Fixed"; }
+    else { menu_items_[MIP_CENTROID_MODE].value = "Random"; }
+    if(draw)draw_item_value(MIP_CENTROID_MODE);
+    set_centroid_value(draw);
+}
+
+void ShowerImageEventGenerator::set_centroid_value(bool draw)
+{
+    if(centroid_mode_ == 0) { rc_to_value_string(menu_items_[MIP_CENTROID].value, cr_, cc_); }
+    else { menu_items_[MIP_CENTROID].value = "N/A"; }
+    if(draw)draw_item_value(MIP_CENTROID);
+}
+
+void ShowerImageEventGenerator::set_spectrum_mode_value(bool draw)
+{
+    if(spectrum_mode_ == 0) { menu_items_[MIP_SPECTRUM_MODE].value = "Fixed"; }
+    else { menu_items_[MIP_SPECTRUM_MODE].value = "Power law"; }
+    if(draw)draw_item_value(MIP_SPECTRUM_MODE);
+    set_index_value(draw);
+}
+
+void ShowerImageEventGenerator::set_size_value(bool draw)
+{
+    menu_items_[MIP_SIZE].value.assign_int(size_);
+    if(draw)draw_item_value(MIP_SIZE);
+}
+
+void ShowerImageEventGenerator::set_index_value(bool draw)
+{
+    if(spectrum_mode_ == 0) {
+        menu_items_[MIP_INDEX].value = "N/A";
+    } else {
+        menu_items_[MIP_INDEX].value.assign_fixed(index_x10_, 1);
+    }
+    if(draw)draw_item_value(MIP_INDEX);
+}
+
+void ShowerImageEventGenerator::set_enabled_value(bool draw)
+{
+    menu_items_[MIP_ENABLED].value = enabled_ ? ">ON<" : "off";
+    menu_items_[MIP_ENABLED].value_style = enabled_ ? ANSI_INVERT : "";
+    if(draw)draw_item_value(MIP_ENABLED);
+}
+
+ShowerImageEventGenerator::Parameters ShowerImageEventGenerator::make_parameters() const
+{
+    Parameters parameters;
+    parameters.freq_mode     = freq_mode_;
+    parameters.period_us_q16 = freq_ > 0 ? uint64_t(period_us_ * 65536.0 + 0.5) : 0;
+    parameters.image_type    = image_type_;
+    parameters.width_x10     = width_x10_;
+    parameters.length_x10    = length_x10_;
+    parameters.radius_x10    = radius_x10_;
+    parameters.orient_mode   = orient_mode_;
+    parameters.orient        = orient_;
+    parameters.centroid_mode = centroid_mode_;
+    parameters.cr            = cr_;
+    parameters.cc            = cc_;
+    parameters.spectrum_mode = spectrum_mode_;
+    parameters.size          = size_;
+    parameters.index_x10     = index_x10_;
+    parameters.enabled       = enabled_ and freq_ > 0;
+    return parameters;
+}
+
+void ShowerImageEventGenerator::publish_parameters()
+{
+    // Only wake the dispatcher if something has changed, as it drops the
+    // events it has queued and starts again when it is woken
+    Parameters parameters = make_parameters();
+    if(parameters == published_) {
+        return;
+    }
+    published_ = parameters;
+    parameters_.publish(parameters);
+    EventDispatcher::instance().notify_dispatcher();
+}
+
+template<typename F> void ShowerImageEventGenerator::build_shape(Shape& shape,
+    int max_offset, F amplitude)
+{
+    // Tabulate the pixels within "max_offset" of the centroid that are
+    // brighter than the threshold, relative to the brightest. If there are
+    // too many the faintest are dropped.
+    max_offset = std::min(max_offset, 15);
+    float max_amplitude = 0;
+    for(int dr=-max_offset; dr<=max_offset; ++dr) {
+        for(int dc=-max_offset; dc<=max_offset; ++dc) {
+            max_amplitude = std::max(max_amplitude, amplitude(dr, dc));
+        }
+    }
+    shape.npixel = 0;
+    shape.amp_sum = 0;
+    if(max_amplitude <= 0) {
+        return;
+    }
+    for(int dr=-max_offset; dr<=max_offset; ++dr) {
+        for(int dc=-max_offset; dc<=max_offset; ++dc) {
+            int amp = int(amplitude(dr, dc) * 255.0f / max_amplitude + 0.5f);
+            if(amp < amplitude_threshold()) {
+                continue;
+            }
+            ShapePixel pixel { int8_t(dr), int8_t(dc), uint8_t(amp) };
+            if(shape.npixel < max_shape_pixels) {
+                shape.pixels[shape.npixel++] = pixel;
+            } else {
+                ShapePixel* faintest = std::min_element(shape.pixels, shape.pixels+shape.npixel,
+                    [](const ShapePixel& a, const ShapePixel& b) { return a.amp < b.amp; });
+                if(faintest->amp < pixel.amp) {
+                    *faintest = pixel;
+                }
+            }
+        }
+    }
+    for(unsigned ipixel=0; ipixel<shape.npixel; ++ipixel) {
+        shape.amp_sum += shape.pixels[ipixel].amp;
+    }
+}
+
+void ShowerImageEventGenerator::build_ellipse_shapes()
+{
+    const float sigma_w = active_.width_x10 * 0.1f;
+    const float sigma_l = active_.length_x10 * 0.1f;
+    for(int iorient=0; iorient<num_orientations; ++iorient) {
+        const float theta = iorient * pi / num_orientations;
+        const float cos_theta = cosf(theta);
+        const float sin_theta = sinf(theta);
+        build_shape(ellipse_shapes_[iorient], int(ceilf(3.0f*sigma_l)),
+            [=](int dr, int dc) {
+                float u = (dc*cos_theta + dr*sin_theta)/sigma_l;
+                float v = (dr*cos_theta - dc*sin_theta)/sigma_w;
+                return expf(-0.5f*(u*u + v*v));
+            });
+    }
+}
+
+void ShowerImageEventGenerator::build_muon_shape()
+{
+    const float radius = active_.radius_x10 * 0.1f;
+    build_shape(muon_shape_, int(ceilf(radius + 3.0f*muon_ring_width)),
+        [=](int dr, int dc) {
+            float x = (sqrtf(float(dr*dr + dc*dc)) - radius)/muon_ring_width;
+            return expf(-0.5f*x*x);
+        });
+}
+
+void ShowerImageEventGenerator::build_spectrum_table()
+{
+    // Inverse of the cumulative distribution of a power law between the
+    // minimum size and spectrum_range() times that, at equally spaced
+    // quantiles. Sampling interpolates between the entries.
+    const double smin = active_.size;
+    if(active_.spectrum_mode == 0) {
+        std::fill(spectrum_table_, spectrum_table_+spectrum_table_size+1, uint32_t(smin));
+        return;
+    }
+    const double a = 1.0 - active_.index_x10 * 0.1;
+    const double b = 1.0 - std::pow(double(spectrum_range()), a);
+    for(unsigned i=0; i<=spectrum_table_size; ++i) {
+        double q = double(i)/spectrum_table_size;
+        spectrum_table_[i] = uint32_t(smin * std::pow(1.0 - q*b, 1.0/a) + 0.5);
+    }
+}
+
+uint64_t ShowerImageEventGenerator::next_image_delay()
+{
+    if(active_.freq_mode == 0) {
+        return active_.period_us_q16;
+    } else {
+        // Drop 8 fractional bits of the period so the product fits 64 bits
+        return ((active_.period_us_q16 >> 8) * rng_.exponential_q24()) >> 16;
+    }
+}
+
+uint32_t ShowerImageEventGenerator::next_image_size()
+{
+    uint32_t u = rng_.next();
+    unsigned i = u >> 24;
+    uint32_t f = (u >> 16) & 0xFF;
+    return spectrum_table_[i] + (((spectrum_table_[i+1] - spectrum_table_[i]) * f) >> 8);
+}
+
+void ShowerImageEventGenerator::start_image()
+{
+    bool muon = active_.image_type == IT_MUON or (active_.image_type == IT_MIXED
+        and rng_.uniform(100) < uint32_t(mixed_muon_percent()));
+    if(muon) {
+        image_shape_ = &muon_shape_;
+    } else if(active_.orient_mode == 0) {
+        image_shape_ = &ellipse_shapes_[active_.orient];
+    } else {
+        image_shape_ = &ellipse_shapes_[rng_.uniform(num_orientations)];
+    }
+    if(active_.centroid_mode == 0) {
+        image_r_ = active_.cr;
+        image_c_ = active_.cc;
+    } else {
+        image_r_ = rng_.uniform(16);
+        image_c_ = rng_.uniform(16);
+    }
+    // Scale so the amplitudes of all the pixels add up to the image size,
+    // limited to where the brightest pixel saturates anyway
+    image_scale_q16_ = image_shape_->amp_sum == 0 ? 0 : std::min(
+        (uint64_t(next_image_size()) << 16) / image_shape_->amp_sum, uint64_t(256) << 16);
+    image_delay_us_q16_ += next_image_delay();
+    image_ipixel_ = 0;
+}
+
+unsigned ShowerImageEventGenerator::nextEvents(Event* events, unsigned max_events, uint32_t horizon_us)
+{
+    // Pick up any parameters published since the last block, rebuilding the
+    // tables that depend on them
+    Parameters previous = active_;
+    if(parameters_.read_if_changed(active_, active_seq_)) {
+        if(active_.width_x10 != previous.width_x10 or active_.length_x10 != previous.length_x10) {
+            build_ellipse_shapes();
+        }
+        if(active_.radius_x10 != previous.radius_x10) {
+            build_muon_shape();
+        }
+        if(active_.spectrum_mode != previous.spectrum_mode or active_.size != previous.size
+                or active_.index_x10 != previous.index_x10) {
+            build_spectrum_table();
+        }
+        image_shape_ = nullptr;
+        image_delay_us_q16_ = 0;
+    }
+    if(not active_.enabled) {
+        return 0;
+    }
+
+    // Each image is sent as a burst, the first pixel carrying the delay since
+    // the previous image and the rest following it immediately. An image may
+    // be split over more than one block.
+    const uint64_t horizon_us_q16 = uint64_t(horizon_us) << 16;
+    uint64_t total_delay_us_q16 = 0;
+    unsigned nevent = 0;
+    while(nevent < max_events and total_delay_us_q16 < horizon_us_q16) {
+        if(image_shape_ == nullptr or image_ipixel_ == image_shape_->npixel) {
+            if(image_shape_ != nullptr and image_delay_us_q16_ != 0) {
+                // None of the image landed on the matrix, keep its time with
+                // an event that does not flash
+                events[nevent].delay_us_q16 = image_delay_us_q16_;
+                events[nevent].pattern = 0;
+                total_delay_us_q16 += image_delay_us_q16_;
+                image_delay_us_q16_ = 0;
+                image_shape_ = nullptr;
+                ++nevent;
+                continue;
+            }
+            start_image();
+        }
+        const ShapePixel& pixel = image_shape_->pixels[image_ipixel_++];
+        int ar = image_r_ + pixel.dr;
+        int ac = image_c_ + pixel.dc;
+        uint32_t amp = std::min((pixel.amp * image_scale_q16_) >> 16, uint32_t(255));
+        if(ar < 0 or ar > 15 or ac < 0 or ac > 15 or amp == 0) {
+            continue;
+        }
+        events[nevent].delay_us_q16 = image_delay_us_q16_;
+        events[nevent].pattern = make_pattern(ar, ac, amp);
+        total_delay_us_q16 += image_delay_us_q16_;
+        image_delay_us_q16_ = 0;
+        ++nevent;
+    }
+    return nevent;
+}
+
+bool ShowerImageEventGenerator::process_key_press(int key, int key_count, int& return_code,
+    const std::vector<std::string>& escape_sequence_parameters,
+    absolute_time_t& next_timer)
+{
+    int step = key_count >= 15 ? 5 : 1;
+    switch(key) {
+    case 'F':
+        freq_mode_ = (freq_mode_ == 0) ? 1 : 0;
+        set_freq_mode_value();
+        break;
+    case '+':
+        if(freq_<max_freq()) {
+            double df = 0.1;
+            if(freq_ >= 3000 || (freq_ >= 300 && key_count>10)) { df = 100; }
+            else if(freq_ >= 300 || (freq_ >= 30 && key_count>10)) { df = 10.0; }
+            else if(freq_ >= 30 || key_count>10) { df = 1.0; }
+            freq_ = std::min((std::floor(freq_/df + 0.5) + 1.0) * df, max_freq());
+            period_us_ = 1000000.0/freq_;
+            set_freq_value();
+        }
+        break;
+    case '-':
+    case '_':
+        if(freq_>0.0) {
+            double df = 0.1;
+            if(freq_ > 3000 || (freq_ > 300 && key_count>10)) { df = 100; }
+            else if(freq_ > 300 || (freq_ > 30 && key_count>10)) { df = 10.0; }
+            else if(freq_ > 30 || key_count>10) { df = 1.0; }
+            freq_ = std::max((std::floor(freq_/df + 0.5) - 1.0) * df, 0.0);
+            period_us_ = 1000000.0/freq_;
+            set_freq_value();
+        }
+        break;
+    case '0': case '1': case '2': case '3': case '4': case '5':
+        if(key_count >= 10) {
+            double new_freq = 0.1;
+            while(key > '0') { new_freq *= 10.0; --key; }
+            if(freq_ != new_freq) {
+                freq_ = new_freq;
+                period_us_ = 1000000.0/freq_;
+                set_freq_value();
+            }
+        }
+        break;
+    case 'T':
+        image_type_ = (image_type_ + 1) % 3;
+        set_image_type_value();
+        break;
+    case 'W':
+        if(increase_value_in_range(width_x10_, std::min(length_x10_, 30), step, key_count==1)) {
+            set_width_value();
+        }
+        break;
+    case 'w':
+        if(decrease_value_in_range(width_x10_, 3, step, key_count==1)) {
+            set_width_value();
+        }
+        break;
+    case 'L':
+        if(increase_value_in_range(length_x10_, 50, step, key_count==1)) {
+            set_length_value();
+        }
+        break;
+    case 'l':
+        if(decrease_value_in_range(length_x10_, width_x10_, step, key_count==1)) {
+            set_length_value();
+        }
+        break;
+    case 'R':
+        if(increase_value_in_range(radius_x10_, 70, step, key_count==1)) {
+            set_radius_value();
+        }
+        break;
+    case 'r':
+        if(decrease_value_in_range(radius_x10_, 10, step, key_count==1)) {
+            set_radius_value();
+        }
+        break;
+    case 'O':
+        orient_mode_ = (orient_mode_ == 0) ? 1 : 0;
+        set_orient_mode_value();
+        break;
+    case '[':
+        if(orient_mode_ == 0) {
+            orient_ = (orient_ + num_orientations - 1) % num_orientations;
+            set_orient_value();
+        }
+        break;
+    case ']':
+        if(orient_mode_ == 0) {
+            orient_ = (orient_ + 1) % num_orientations;
+            set_orient_value();
+        }
+        break;
+    case 'C':
+        centroid_mode_ = (centroid_mode_ == 0) ? 1 : 0;
+        set_centroid_mode_value();
+        break;
+    case 'I':
+        spectrum_mode_ = (spectrum_mode_ == 0) ? 1 : 0;
+        set_spectrum_mode_value();
+        break;
+    case '>':
+        if(increase_value_in_range(size_, max_size(), 10*step, key_count==1)) {
+            set_size_value();
+        }
+        break;
+    case '<':
+        if(decrease_value_in_range(size_, 10, 10*step, key_count==1)) {
+            set_size_value();
+        }
+        break;
+    case '}':
+        if(spectrum_mode_ != 0 and increase_value_in_range(index_x10_, 40, 1, key_count==1)) {
+            set_index_value();
+        }
+        break;
+    case '{':
+        if(spectrum_mode_ != 0 and decrease_value_in_range(index_x10_, 11, 1, key_count==1)) {
+            set_index_value();
+        }
+        break;
+    case 'S':
+        if(enabled_ and key_count == 1) {
+            enabled_ = false;
+            set_enabled_value();
+        } else if(key_count >= 10 and not enabled_) {
+            enabled_ = true;
+            set_enabled_value();
+        }
+        break;
+    case 's':
+        if(enabled_) {
+            enabled_ = false;
+            set_enabled_value();
+        }
+        break;
+    default:
+        if(centroid_mode_ == 0 and process_rc_keys(cr_, cc_, key, key_count)) {
+            set_centroid_value();
+        }
+        break;
+    }
+    publish_parameters();
+    return true;
+}
+
+bool ShowerImageEventGenerator::process_timer(bool controller_is_connected, int& return_code,
+    absolute_time_t& next_timer)
+{
+    return true;
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <string>
+
+#include "menu.hpp"
+#include "seqlock.hpp"
+#include "rng.hpp"
+#include "event_generators.hpp"
+
+// Generates Cherenkov-like images on the 16x16 matrix : Hillas ellipses,
+// with their size drawn from a fixed value or a power-law spectrum, and muon
+// rings. The pixels of each image are sent as one burst of events with no
+// delay between them, so an image of dozens of LEDs takes a few microseconds.
+//
+// The shapes are held in tables of pixel offsets and relative amplitudes, one
+// per orientation of the ellipse and one for the ring. They are rebuilt on
+// the core that generates the events whenever the shape parameters change,
+// so generating an image only needs integer arithmetic. The tables take a
+// few kilobytes, so instances should not be put on the (small) stack.
+class ShowerImageEventGenerator: public EventGenerator, public SimpleItemValueMenu {
+public:
+    ShowerImageEventGenerator();
+    virtual ~ShowerImageEventGenerator();
+
+    unsigned nextEvents(Event* events, unsigned max_events, uint32_t horizon_us) final;
+
+    bool process_key_press(int key, int key_count, int& return_code,
+        const std::vector<std::string>& escape_sequence_parameters,
+        absolute_time_t& next_timer) final;
+    bool process_timer(bool controller_is_connected, int& return_code,
+        absolute_time_t& next_timer) final;
+
+private:
+    enum MenuItemPositions {
+        MIP_FREQ_MODE,
+        MIP_FREQ,
+        MIP_FREQ_DECADE,
+        MIP_IMAGE_TYPE,
+        MIP_WIDTH,
+        MIP_LENGTH,
+        MIP_RADIUS,
+        MIP_ORIENT_MODE,
+        MIP_ORIENT,
+        MIP_CENTROID_MODE,
+        MIP_CENTROID,
+        MIP_SPECTRUM_MODE,
+        MIP_SIZE,
+        MIP_INDEX,
+        MIP_ENABLED,
+        MIP_NUM_ITEMS // MUST BE LAST ITEM IN LIST
+    };
+
+    static std::vector<MenuItem> make_menu_items();
+
+    void set_freq_mode_value(bool draw = true);
+    void set_freq_value(bool draw = true);
+    void set_image_type_value(bool draw = true);
+    void set_width_value(bool draw = true);
+    void set_length_value(bool draw = true);
+    void set_radius_value(bool draw = true);
+    void set_orient_mode_value(bool draw = true);
+    void set_orient_value(bool draw = true);
+    void set_centroid_mode_value(bool draw = true);
+    void set_centroid_value(bool draw = true);
+    void set_spectrum_mode_value(bool draw = true);
+    void set_size_value(bool draw = true);
+    void set_index_value(bool draw = true);
+    void set_enabled_value(bool draw = true);
+
+    static double max_freq() { return 10000.0; } // Hz
+    static int max_size() { return 20000; } // sum of the DAC values of an image
+    static int spectrum_range() { return 16; } // ratio of largest to smallest size
+    static int mixed_muon_percent() { return 10; }
+    static int amplitude_threshold() { return 8; } // of 255, for pixels in a shape
+
+    static const int num_orientations = 16;   // over 180 degrees
+    static const unsigned max_shape_pixels = 128;
+    static const unsigned spectrum_table_size = 256;
+
+    enum ImageType { IT_ELLIPSE, IT_MUON, IT_MIXED };
+
+    // Parameters used by the generating core. They are edited on the menu
+    // core and published as one block after each key press. Lengths are in
+    // tenths of a pixel, and the spectral index in tenths.
+    struct Parameters {
+        int freq_mode;
+        uint64_t period_us_q16; // fixed point with 16 fractional bits
+        int image_type;
+        int width_x10;
+        int length_x10;
+        int radius_x10;
+        int orient_mode;
+        int orient;
+        int centroid_mode;
+        int cr;
+        int cc;
+        int spectrum_mode;
+        int size;
+        int index_x10;
+        bool enabled;
+
+        bool operator==(const Parameters& o) const {
+            return freq_mode == o.freq_mode and period_us_q16 == o.period_us_q16
+                and image_type == o.image_type and width_x10 == o.width_x10
+                and length_x10 == o.length_x10 and radius_x10 == o.radius_x10
+                and orient_mode == o.orient_mode and orient == o.orient
+                and centroid_mode == o.centroid_mode and cr == o.cr and cc == o.cc
+                and spectrum_mode == o.spectrum_mode and size == o.size
+                and index_x10 == o.index_x10 and enabled == o.enabled;
+        }
+    };
+
+    struct ShapePixel {
+        int8_t dr;
+        int8_t dc;
+        uint8_t amp; // relative to the brightest pixel, which is 255
+    };
+
+    struct Shape {
+        unsigned npixel;
+        uint32_t amp_sum;
+        ShapePixel pixels[max_shape_pixels];
+    };
+
+    Parameters make_parameters() const;
+    void publish_parameters();
+
+    void build_ellipse_shapes();
+    void build_muon_shape();
+    void build_spectrum_table();
+    template<typename F> static void build_shape(Shape& shape, int max_offset, F amplitude);
+
+    void start_image();
+    uint64_t next_image_delay();
+    uint32_t next_image_size();
+
+    SeqLock<Parameters> parameters_;
+    Parameters published_ = {};
+
+    // Everything below here, up to the menu state, belongs to the
+    // generating core
+    Parameters active_ = {};
+    uint32_t active_seq_ = SeqLock<Parameters>::unread_seq();
+    FastRNG rng_;
+    Shape ellipse_shapes_[num_orientations];
+    Shape muon_shape_;
+    uint32_t spectrum_table_[spectrum_table_size+1];
+
+    const Shape* image_shape_ = nullptr;
+    unsigned image_ipixel_ = 0;
+    int image_r_ = 0;
+    int image_c_ = 0;
+    uint32_t image_scale_q16_ = 0;
+    uint64_t image_delay_us_q16_ = 0;
+
+    int freq_mode_ = 0;
+    double freq_ = 100; // Hz
+    double period_us_ = 1000000.0/freq_;
+    int image_type_ = IT_ELLIPSE;
+    int width_x10_ = 10;
+    int length_x10_ = 20;
+    int radius_x10_ = 40;
+    int orient_mode_ = 1;
+    int orient_ = 0;
+    int centroid_mode_ = 1;
+    int cr_ = 7;
+    int cc_ = 7;
+    int spectrum_mode_ = 0;
+    int size_ = 1000;
+    int index_x10_ = 27;
+    bool enabled_ = false;
+};
@@ -0,0 +1,101 @@
+#include <algorithm>
+
+#include <hardware/gpio.h>
+#include <hardware/clocks.h>
+
+#include "build_date.hpp"
+#include "flasher.hpp"
+#include "spi_delay.hpp"
+#include "spi_delay.pio.h"
+
+namespace {
+    static BuildDate build_date(__DATE__,__TIME__);
+
+    uint32_t spi_pin_mask()
+    {
+        return (0x0000FF << ROW_A_BASE_PIN) | (0x1U << SPI_CLK_PIN) | (0x1U << SPI_DOUT_PIN)
+            | (0x1U << SPI_COL_EN_PIN) | (0x1U << SPI_ALL_EN_PIN);
+    }
+}
+
+bool SPIDelayEngine::add_record(uint32_t record)
+{
+    if(nrecord_ == max_records) {
+        return false;
+    }
+    records_[nrecord_++] = record;
+    return true;
+}
+
+bool SPIDelayEngine::add_led(int ar, int ac, int delay)
+{
+    uint32_t rowcol = (ar & 0x0F) | ((ac & 0x0F) << (COL_A_BASE_PIN - ROW_A_BASE_PIN));
+    return add_record((rowcol << 24) | (uint32_t(delay & 0xFF) << 15));
+}
+
+bool SPIDelayEngine::add_broadcast(int delay)
+{
+    return add_record((1U << 23) | (uint32_t(delay & 0xFF) << 15));
+}
+
+uint32_t SPIDelayEngine::max_clock_hz()
+{
+    return clock_get_hz(clk_sys) / SPI_DELAY_CYCLES_PER_BIT;
+}
+
+uint32_t SPIDelayEngine::transfer_duration_us() const
+{
+    return uint64_t(nrecord_) * SPI_DELAY_CYCLES_PER_RECORD * 1000000
+        / (uint64_t(clock_hz_) * SPI_DELAY_CYCLES_PER_BIT);
+}
+
+bool SPIDelayEngine::start()
+{
+    if(running_) {
+        stop();
+    }
+    if(nrecord_ == 0 or clock_hz_ == 0 or clock_hz_ > max_clock_hz()) {
+        return false;
+    }
+
+    // The row and column pins are shared with set_charges on pio0, so
+    // stop() gives them back to whichever function had them
+    for(unsigned i=0; i<32; ++i) {
+        if(spi_pin_mask() & (1U << i)) {
+            saved_function_[i] = gpio_get_function(i);
+        }
+    }
+
+    transfer_.claim(pio1, &spi_delay_program);
+    spi_delay_program_init(transfer_.pio(), transfer_.sm(), transfer_.offset(),
+        ROW_A_BASE_PIN, SPI_CLK_PIN, SPI_COL_EN_PIN,
+        float(clock_get_hz(clk_sys)) / float(clock_hz_ * SPI_DELAY_CYCLES_PER_BIT));
+    transfer_.start_once(records_, nrecord_);
+    running_ = true;
+    return true;
+}
+
+void SPIDelayEngine::stop()
+{
+    if(not running_) {
+        return;
+    }
+    transfer_.release();
+    // Hand the pins back, idle as program_delay used to leave them if the
+    // SIO had them
+    gpio_put_masked(spi_pin_mask(), 0);
+    for(unsigned i=0; i<32; ++i) {
+        if(spi_pin_mask() & (1U << i)) {
+            gpio_set_function(i, saved_function_[i]);
+        }
+    }
+    running_ = false;
+}
+
+bool SPIDelayEngine::is_busy()
+{
+    if(running_ and transfer_.is_finished()) {
+        stop();
+    }
+    return running_;
+}
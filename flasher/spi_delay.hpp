@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+
+#include <hardware/gpio.h>
+
+#include "pio_dma_transfer.hpp"
+
+// Programs the delays of the LEDs over the SPI_CLK / SPI_DOUT / SPI_COL_EN /
+// SPI_ALL_EN interface with the spi_delay state machine. The delays to write
+// are queued as records, one per LED or one broadcast to all LEDs, which DMA
+// feeds to the state machine once the transfer is started. The CPU does not
+// wait for the transfer, the menus poll is_busy() which hands the pins back
+// to their previous functions once the last record has been shifted out.
+class SPIDelayEngine
+{
+public:
+    void clear() { nrecord_ = 0; }
+    bool add_led(int ar, int ac, int delay);
+    bool add_broadcast(int delay);
+    unsigned num_records() const { return nrecord_; }
+
+    bool start();
+    void stop();
+    bool is_busy();
+
+    // Rate of SPI_CLK, and the time needed to shift out the queued records
+    void set_clock_hz(uint32_t clock_hz) { clock_hz_ = clock_hz; }
+    uint32_t clock_hz() const { return clock_hz_; }
+    static uint32_t max_clock_hz();
+    uint32_t transfer_duration_us() const;
+
+    static SPIDelayEngine& instance() {
+        static SPIDelayEngine the_singleton;
+        return the_singleton;
+    }
+private:
+    SPIDelayEngine() { }
+    SPIDelayEngine(SPIDelayEngine&);
+    SPIDelayEngine& operator=(SPIDelayEngine const&);
+
+    bool add_record(uint32_t record);
+
+    static const unsigned max_records = 512;
+
+    PIODMATransfer transfer_;
+    bool running_ = false;
+    uint32_t clock_hz_ = 4000000;
+    gpio_function_t saved_function_[32];
+
+    uint32_t records_[max_records];
+    unsigned nrecord_ = 0;
+};
@@ -2,6 +2,9 @@
 #include "menu.hpp"
 #include "input_menu.hpp"
 #include "spi_test_menu.hpp"
+#include "spi_delay.hpp"
+#include "delay_map.hpp"
+#include "trigger_generator.hpp"
 
 namespace {
     static BuildDate build_date(__DATE__,__TIME__);
@@ -19,6 +22,12 @@ void SPItestMenu::sync_values()
     vdac_    = (all_gpio >> VDAC_BASE_PIN)  & 0x0000FF;
     ar_      = (all_gpio >> ROW_A_BASE_PIN) & 0x00000F;
     ac_      = (all_gpio >> COL_A_BASE_PIN) & 0x00000F;
+    delay_   = DelayMap::instance().get(ar_, ac_);
+    spi_clock_khz_ = SPIDelayEngine::instance().clock_hz() / 1000;
+    set_delay_value(false);
+    set_changed_value(false);
+    set_spi_clock_value(false);
+    set_enable_auto_trigger_value(false);
 }
 
 void SPItestMenu::delay()
@@ -26,29 +35,47 @@ void SPItestMenu::delay()
     sleep_us(1);
 }
 
-void SPItestMenu::program_delay()
+void SPItestMenu::program_delay(bool all_leds)
 {
-    mask_ = 128;
-    int i;
-    gpio_put(SPI_CLK_PIN, 1);
-    gpio_put(SPI_COL_EN_PIN, 1);
-    gpio_put_masked((0x00000F << ROW_A_BASE_PIN)|(0x00000F << COL_A_BASE_PIN),
-                        (ar_ << ROW_A_BASE_PIN)|(ac_ << COL_A_BASE_PIN));
-    delay();
-    for(i = 7; i >= 0; i -= 1) {
-        gpio_put(SPI_DOUT_PIN, delay_ & mask_ ? 1 : 0);
-        gpio_put(SPI_CLK_PIN, 0);
-        delay();
-        gpio_put(SPI_CLK_PIN, 1);
-        delay();
-        mask_ = mask_ >> 1;
+    DelayMap& map = DelayMap::instance();
+    if(all_leds) {
+        map.invalidate_programmed();
     }
-    gpio_put(SPI_COL_EN_PIN, 0);
-    gpio_put_masked((0x00000F << ROW_A_BASE_PIN)|(0x00000F << COL_A_BASE_PIN),
-                        (0 << ROW_A_BASE_PIN)|(0 << COL_A_BASE_PIN));
-    delay();
-    gpio_put(SPI_DOUT_PIN, 0);
-    gpio_put(SPI_CLK_PIN, 0);
+    SPIDelayEngine::instance().set_clock_hz(spi_clock_khz_ * 1000);
+    int nrecord = map.apply();
+    if(nrecord < 0) {
+        beep();
+        return;
+    }
+    set_changed_value();
+    if(nrecord > 0) {
+        enable_ = true;
+        set_enable_value();
+    }
+}
+
+void SPItestMenu::upload_map()
+{
+    uint8_t delays[DelayMap::num_leds];
+    int ndelay = InputMenu::input_byte_table(delays, DelayMap::num_leds,
+        "Upload delay map (rows A to P)", this);
+    this->redraw();
+    if(ndelay < 0) {
+        return;
+    }
+    if(not DelayMap::instance().assign(delays, ndelay)) {
+        beep();
+        return;
+    }
+    delay_ = DelayMap::instance().get(ar_, ac_);
+    set_delay_value();
+    set_changed_value();
+}
+
+void SPItestMenu::finish_program_delay()
+{
+    enable_ = false;
+    set_enable_value();
 }
 
 void SPItestMenu::send_trigger()
@@ -66,10 +93,28 @@ void SPItestMenu::set_rc_value(bool draw)
 
 void SPItestMenu::set_delay_value(bool draw)
 { 
-    menu_items_[MIP_DELAY].value = std::to_string(delay_); 
+    menu_items_[MIP_DELAY].value.assign_int(delay_);
     if(draw)draw_item_value(MIP_DELAY);
 }
 
+void SPItestMenu::set_changed_value(bool draw)
+{
+    menu_items_[MIP_CHANGED].value.assign_int(DelayMap::instance().num_changed());
+    if(draw)draw_item_value(MIP_CHANGED);
+}
+
+void SPItestMenu::set_flash_map_value(const char* status, bool draw)
+{
+    menu_items_[MIP_FLASH_MAP].value = status;
+    if(draw)draw_item_value(MIP_FLASH_MAP);
+}
+
+void SPItestMenu::set_spi_clock_value(bool draw)
+{
+    menu_items_[MIP_SPI_CLOCK].value.assign_int(spi_clock_khz_);
+    if(draw)draw_item_value(MIP_SPI_CLOCK);
+}
+
 void SPItestMenu::set_enable_value(bool draw) 
 { 
     menu_items_[MIP_ENABLE].value = enable_ ? ">ENABLE<" : "disable"; 
@@ -86,8 +131,9 @@ void SPItestMenu::set_trigger_value(bool draw)
 
 void SPItestMenu::set_enable_auto_trigger_value(bool draw) 
 { 
-    menu_items_[MIP_AUTO_TRIGGER].value = enable_auto_trigger_ ? ">ENABLE<" : "disable"; 
-    menu_items_[MIP_AUTO_TRIGGER].value_style = enable_auto_trigger_ ? ANSI_INVERT : "";
+    bool running = TriggerGenerator::instance().is_running();
+    menu_items_[MIP_AUTO_TRIGGER].value = running ? ">ENABLE<" : "disable";
+    menu_items_[MIP_AUTO_TRIGGER].value_style = running ? ANSI_INVERT : "";
     if(draw)draw_item_value(MIP_AUTO_TRIGGER);
 }
 
@@ -95,10 +141,16 @@ std::vector<SimpleItemValueMenu::MenuItem> SPItestMenu::make_menu_items()
 {
     std::vector<SimpleItemValueMenu::MenuItem> menu_items(MIP_NUM_ITEMS);
     menu_items.at(MIP_ROWCOL)       = {"Cursors : Change column & row", 3, "A0"};
-    menu_items.at(MIP_DELAY)        = {"</d/>   : Delay", 3, "0"};
-    menu_items.at(MIP_ENABLE)       = {"P       : Program delay", 8, "disable"};
+    menu_items.at(MIP_DELAY)        = {"</d/>   : Delay of LED in map", 3, "0"};
+    menu_items.at(MIP_FILL_MAP)     = {"F       : Fill map with delay", 0, ""};
+    menu_items.at(MIP_UPLOAD_MAP)   = {"U       : Upload delay map", 0, ""};
+    menu_items.at(MIP_FLASH_MAP)    = {"W/L     : Write / load map in flash", 6, ""};
+    menu_items.at(MIP_CHANGED)      = {"Delays changed since programmed", 3, "256"};
+    menu_items.at(MIP_SPI_CLOCK)    = {"c       : SPI clock (kHz)", 5, "4000"};
+    menu_items.at(MIP_ENABLE)       = {"P       : Program changed delays", 8, "disable"};
+    menu_items.at(MIP_PROGRAM_ALL)  = {"X       : Program all delays", 0, ""};
     menu_items.at(MIP_TRIGGER)      = {"T       : Send trigger", 4, "off"};
-    menu_items.at(MIP_AUTO_TRIGGER) = {"A       : enable auto-trigger", 8, "disable"};
+    menu_items.at(MIP_AUTO_TRIGGER) = {"A       : Enable trigger generator", 8, "disable"};
     menu_items.at(MIP_EXIT)         = {"Q       : Exit menu", 0, ""};
     return menu_items;
 }
@@ -118,19 +170,26 @@ bool SPItestMenu::controller_disconnected(int& return_code)
 bool SPItestMenu::process_key_press(int key, int key_count, int& return_code,
     const std::vector<std::string>& escape_sequence_parameters, absolute_time_t& next_timer)
 {
+    DelayMap& map = DelayMap::instance();
     if(process_rc_keys(ar_, ac_, key, key_count)) {
+        delay_ = map.get(ar_, ac_);
         set_rc_value();
+        set_delay_value();
         return true;
     }
 
     switch (key) {
         case '<':
             decrease_value_in_range(delay_, 0, (key_count >= 15 ? 5 : 1), key_count==1);
+            map.set(ar_, ac_, delay_);
             set_delay_value();
+            set_changed_value();
             break;
         case '>':
             increase_value_in_range(delay_, 255, (key_count >= 15 ? 5 : 1), key_count==1);
+            map.set(ar_, ac_, delay_);
             set_delay_value();
+            set_changed_value();
             break;
         case 'D':
         case 'd':
@@ -147,17 +206,49 @@ bool SPItestMenu::process_key_press(int key, int key_count, int& return_code,
                 } else {
                     input.cancelled();
                 }
+                map.set(ar_, ac_, delay_);
                 set_delay_value(true);
+                set_changed_value();
+            }
+            break;
+        case 'F':
+            map.fill(delay_);
+            set_changed_value();
+            break;
+        case 'U':
+            upload_map();
+            break;
+        case 'W':
+            set_flash_map_value(map.save() ? "saved" : "FAILED");
+            break;
+        case 'L':
+            if(map.load()) {
+                delay_ = map.get(ar_, ac_);
+                set_delay_value();
+                set_changed_value();
+                set_flash_map_value("loaded");
+            } else {
+                set_flash_map_value("FAILED");
             }
             break;
+        case 'C':
+        case 'c':
+            InplaceInputMenu::input_value_in_range(spi_clock_khz_, 1,
+                SPIDelayEngine::max_clock_hz()/1000, this, MIP_SPI_CLOCK);
+            set_spi_clock_value();
+            break;
         case 'P':
-            enable_ = true;
-            set_enable_value();
             program_delay();
-            enable_ = false;
-            set_enable_value();
+            break;
+        case 'X':
+            program_delay(true);
             break;
         case 'T':
+            if(TriggerGenerator::instance().is_running()) {
+                // TRIG_PIN belongs to the trigger generator
+                beep();
+                break;
+            }
             trigger_ = true;
             set_trigger_value();
             send_trigger();
@@ -165,8 +256,16 @@ bool SPItestMenu::process_key_press(int key, int key_count, int& return_code,
             set_trigger_value();
             break;
         case 'A':
-            time_ = 0;
-            enable_auto_trigger_ = !enable_auto_trigger_;
+            // Runs the trigger generator with the settings from the trigger
+            // menu, 10Hz periodic pulses unless they have been changed
+            {
+                TriggerGenerator& generator = TriggerGenerator::instance();
+                if(generator.is_running()) {
+                    generator.stop();
+                } else if(not generator.start(generator.settings())) {
+                    beep();
+                }
+            }
             set_enable_auto_trigger_value();
             break;
         case 'q':
@@ -189,16 +288,8 @@ bool SPItestMenu::process_timer(bool controller_is_connected, int& return_code,
         heartbeat_timer_count_ = 0;
     }
 
-    if (enable_auto_trigger_ == true){
-        time_ += 1;
-        if (time_ >= 10){
-            trigger_ = true;
-            set_trigger_value();
-            send_trigger();
-            trigger_ = false;
-            set_trigger_value();
-            time_ = 0;
-        }
+    if(enable_ and not SPIDelayEngine::instance().is_busy()) {
+        finish_program_delay();
     }
     return true;
 }
\ No newline at end of file
@@ -21,7 +21,13 @@ private:
     enum MenuItemPositions {
         MIP_ROWCOL,
         MIP_DELAY,
+        MIP_FILL_MAP,
+        MIP_UPLOAD_MAP,
+        MIP_FLASH_MAP,
+        MIP_CHANGED,
+        MIP_SPI_CLOCK,
         MIP_ENABLE,
+        MIP_PROGRAM_ALL,
         MIP_TRIGGER,
         MIP_AUTO_TRIGGER,
         MIP_EXIT,
@@ -32,22 +38,25 @@ private:
 
     void sync_values();
     void delay();
-    void program_delay();
+    void program_delay(bool all_leds = false);
+    void finish_program_delay();
+    void upload_map();
     void send_trigger();
     void set_rc_value(bool draw = true);
     void set_delay_value(bool draw = true);
+    void set_changed_value(bool draw = true);
+    void set_flash_map_value(const char* status, bool draw = true);
+    void set_spi_clock_value(bool draw = true);
     void set_enable_value(bool draw = true);
     void set_trigger_value(bool draw = true);
     void set_enable_auto_trigger_value(bool draw = true);
 
     int delay_ = 0;
-    int mask_ = 0;
+    int spi_clock_khz_ = 0;
     int vdac_ = 0;
     int ac_ = 0;
     int ar_ = 0;
-    float time_ = 0;
     bool enable_ = 0;
     bool trigger_ = 0;
-    bool enable_auto_trigger_ = 0;
     unsigned heartbeat_timer_count_ = 0;
 };
\ No newline at end of file
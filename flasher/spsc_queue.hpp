@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Lock-free queue of fixed size between a producer on one core and a
+// consumer on the other. Slots are filled and drained in place, so large
+// blocks are never copied : the producer fills the slot returned by
+// free_slot() and then calls push(), the consumer reads the slot returned by
+// front() and calls pop() once it has finished with it.
+template<typename T, unsigned N> class SPSCQueue {
+public:
+    static_assert(N > 0 and (N & (N-1)) == 0, "SPSCQueue size must be a power of two");
+
+    // Producer side, returns nullptr if the queue is full
+    T* free_slot() {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        if(head - tail_.load(std::memory_order_acquire) == N) {
+            return nullptr;
+        }
+        return &slots_[head & (N-1)];
+    }
+
+    void push() {
+        head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Consumer side, returns nullptr if the queue is empty
+    T* front() {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        if(head_.load(std::memory_order_acquire) == tail) {
+            return nullptr;
+        }
+        return &slots_[tail & (N-1)];
+    }
+
+    void pop() {
+        tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Consumer side, drop everything that has been pushed so far
+    void clear() {
+        tail_.store(head_.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+private:
+    std::atomic<uint32_t> head_ { 0 };
+    std::atomic<uint32_t> tail_ { 0 };
+    T slots_[N];
+};
@@ -0,0 +1,146 @@
+#include <cmath>
+#include <algorithm>
+
+#include <hardware/gpio.h>
+#include <hardware/clocks.h>
+
+#include "build_date.hpp"
+#include "flasher.hpp"
+#include "rng.hpp"
+#include "event_dispatcher.hpp"
+#include "trigger_generator.hpp"
+#include "trigger_out.pio.h"
+
+namespace {
+    static BuildDate build_date(__DATE__,__TIME__);
+}
+
+float TriggerGenerator::max_rate_hz()
+{
+    return float(clock_get_hz(clk_sys)) / float(2*TRIGGER_OUT_SEGMENT_OVERHEAD);
+}
+
+bool TriggerGenerator::add_segment(bool level, uint64_t cycles)
+{
+    // Segments too long for one record are split, the state machine taking
+    // TRIGGER_OUT_SEGMENT_OVERHEAD cycles more than the count of each
+    while(cycles >= TRIGGER_OUT_SEGMENT_OVERHEAD) {
+        if(nsegment_ == max_segments) {
+            return false;
+        }
+        uint32_t count = std::min<uint64_t>(cycles - TRIGGER_OUT_SEGMENT_OVERHEAD,
+            TRIGGER_OUT_MAX_SEGMENT_COUNT);
+        segments_[nsegment_++] = (count << 1) | (level ? 1 : 0);
+        cycles -= count + TRIGGER_OUT_SEGMENT_OVERHEAD;
+    }
+    return true;
+}
+
+bool TriggerGenerator::add_pulse(uint32_t width_cycles, uint64_t period_cycles)
+{
+    return add_segment(true, width_cycles)
+        and add_segment(false, period_cycles - width_cycles);
+}
+
+bool TriggerGenerator::start(const Settings& settings)
+{
+    if(running_) {
+        stop();
+    }
+    settings_ = settings;
+    if(EventDispatcher::instance().is_event_trigger_enabled()) {
+        // The dispatcher is driving TRIG_PIN with its per-flash triggers
+        return false;
+    }
+
+    float clk_hz = clock_get_hz(clk_sys);
+    uint32_t width_cycles = std::max<uint32_t>(
+        std::lround(settings.width_ns * 1e-9f * clk_hz), TRIGGER_OUT_SEGMENT_OVERHEAD);
+    uint64_t min_period_cycles = width_cycles + TRIGGER_OUT_SEGMENT_OVERHEAD;
+    if(settings.rate_hz <= 0) {
+        return false;
+    }
+    uint64_t period_cycles = std::llround(double(clk_hz) / settings.rate_hz);
+
+    nsegment_ = 0;
+    switch(settings.mode) {
+    case MODE_PERIODIC:
+        {
+            // The control channel takes a few cycles to restart the data
+            // channel at the end of the table, which at high rates would
+            // stretch a pulse, so fill the table with as many as it holds
+            if(period_cycles < min_period_cycles) {
+                return false;
+            }
+            add_pulse(width_cycles, period_cycles);
+            unsigned pulse_segments = nsegment_;
+            while(nsegment_ + pulse_segments <= max_segments) {
+                add_pulse(width_cycles, period_cycles);
+            }
+        }
+        break;
+    case MODE_BURST:
+        {
+            if(period_cycles < min_period_cycles or settings.burst_pulses == 0
+                    or settings.burst_rate_hz <= 0) {
+                return false;
+            }
+            uint64_t burst_cycles = std::llround(double(clk_hz) / settings.burst_rate_hz);
+            uint64_t train_cycles = (settings.burst_pulses-1) * period_cycles + min_period_cycles;
+            if(burst_cycles < train_cycles) {
+                return false;
+            }
+            for(unsigned i=0; i+1<settings.burst_pulses; ++i) {
+                if(not add_pulse(width_cycles, period_cycles)) {
+                    return false;
+                }
+            }
+            // The last pulse of the burst is followed by the gap to the next
+            if(not add_pulse(width_cycles, burst_cycles - (settings.burst_pulses-1) * period_cycles)) {
+                return false;
+            }
+        }
+        break;
+    case MODE_POISSON:
+        {
+            // Intervals shorter than a pulse are lengthened, which is the
+            // dead time of the generator. Drop 8 fractional bits of the
+            // sample so the product fits 64 bits at the lowest rates.
+            FastRNG rng;
+            for(unsigned i=0; i<poisson_pulses(); ++i) {
+                uint64_t interval_cycles = (period_cycles * (rng.exponential_q24() >> 8)) >> 16;
+                if(not add_pulse(width_cycles, std::max(interval_cycles, min_period_cycles))) {
+                    break;
+                }
+            }
+        }
+        break;
+    default:
+        return false;
+    }
+    if(nsegment_ == 0) {
+        return false;
+    }
+
+    transfer_.claim(pio1, &trigger_out_program);
+    trigger_out_program_init(transfer_.pio(), transfer_.sm(), transfer_.offset(), TRIG_PIN);
+
+    // The table is restarted from the beginning each time it reaches the end
+    restart_address_ = segments_;
+    transfer_.start_looped(segments_, nsegment_, &restart_address_, false);
+    running_ = true;
+    return true;
+}
+
+void TriggerGenerator::stop()
+{
+    if(not running_) {
+        return;
+    }
+    transfer_.release();
+    if(gpio_get_function(TRIG_PIN) == GPIO_FUNC_PIO1) {
+        gpio_put(TRIG_PIN, 0);
+        gpio_set_function(TRIG_PIN, GPIO_FUNC_SIO);
+    }
+    running_ = false;
+}
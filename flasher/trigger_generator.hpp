@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+
+#include "pio_dma_transfer.hpp"
+
+// Generates trigger pulses on TRIG_PIN with the trigger_out state machine.
+// The pulse train is built as a table of (level, length) segments, which DMA
+// feeds to the state machine. A second DMA channel rewrites the read address
+// of the first at the end of the table, so the train repeats without the CPU
+// and keeps running after the menu that started it has exited. Poisson trains
+// are built from a table of random intervals, so the pattern repeats after
+// poisson_pulses() pulses. The generator will not start while the
+// EventDispatcher is driving TRIG_PIN with per-flash triggers.
+class TriggerGenerator
+{
+public:
+    enum Mode { MODE_PERIODIC, MODE_BURST, MODE_POISSON, MODE_NUM_MODES };
+
+    struct Settings {
+        Mode mode = MODE_PERIODIC;
+        float rate_hz = 10;         // Rate of pulses, or mean rate for Poisson
+        uint32_t width_ns = 1000;
+        unsigned burst_pulses = 10; // Pulses in each burst
+        float burst_rate_hz = 1;    // Rate of bursts
+    };
+
+    bool start(const Settings& settings);
+    void stop();
+    bool is_running() const { return running_; }
+    const Settings& settings() const { return settings_; }
+    void set_settings(const Settings& settings) { settings_ = settings; }
+
+    static unsigned poisson_pulses() { return max_segments/2; }
+    static float max_rate_hz();
+
+    static TriggerGenerator& instance() {
+        static TriggerGenerator the_singleton;
+        return the_singleton;
+    }
+private:
+    TriggerGenerator() { }
+    TriggerGenerator(TriggerGenerator&);
+    TriggerGenerator& operator=(TriggerGenerator const&);
+
+    bool add_segment(bool level, uint64_t cycles);
+    bool add_pulse(uint32_t width_cycles, uint64_t period_cycles);
+
+    static const unsigned max_segments = 2048;
+
+    Settings settings_;
+    PIODMATransfer transfer_;
+    bool running_ = false;
+
+    uint32_t segments_[max_segments];
+    unsigned nsegment_ = 0;
+
+    // Read address that the control channel writes to the data channel at
+    // the end of the table
+    const uint32_t* restart_address_ = nullptr;
+};
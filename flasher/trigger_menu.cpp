@@ -0,0 +1,222 @@
+#include <cmath>
+
+#include "build_date.hpp"
+#include "menu.hpp"
+#include "input_menu.hpp"
+#include "trigger_menu.hpp"
+
+namespace {
+    static BuildDate build_date(__DATE__,__TIME__);
+
+    void assign_rate(ItemValue& value, float rate_hz)
+    {
+        if(rate_hz < 100000) {
+            value.assign_fixed(std::lround(rate_hz*1000), 3);
+        } else {
+            value.assign_int(std::lround(rate_hz));
+        }
+    }
+}
+
+TriggerMenu::TriggerMenu() :
+    SimpleItemValueMenu(make_menu_items(), "Trigger menu")
+{
+    sync_values();
+}
+
+void TriggerMenu::sync_values()
+{
+    settings_ = TriggerGenerator::instance().settings();
+    set_status_value(false);
+    set_mode_value(false);
+    set_rate_value(false);
+    set_width_value(false);
+    set_burst_pulses_value(false);
+    set_burst_rate_value(false);
+    set_enable_trigger_value(false);
+}
+
+void TriggerMenu::set_status_value(bool draw)
+{
+    menu_items_[MIP_STATUS].value = TriggerGenerator::instance().is_running() ? "RUNNING" : "OFF";
+    if(draw)draw_item_value(MIP_STATUS);
+}
+
+void TriggerMenu::set_mode_value(bool draw)
+{
+    static const char* name[]= {"Periodic", "Burst", "Poisson"};
+    menu_items_[MIP_MODE].value = name[settings_.mode];
+    if(draw)draw_item_value(MIP_MODE);
+}
+
+void TriggerMenu::set_rate_value(bool draw)
+{
+    assign_rate(menu_items_[MIP_RATE].value, settings_.rate_hz);
+    if(draw)draw_item_value(MIP_RATE);
+}
+
+void TriggerMenu::set_width_value(bool draw)
+{
+    menu_items_[MIP_WIDTH].value.assign_int(settings_.width_ns);
+    if(draw)draw_item_value(MIP_WIDTH);
+}
+
+void TriggerMenu::set_burst_pulses_value(bool draw)
+{
+    menu_items_[MIP_BURST_PULSES].value.assign_int(settings_.burst_pulses);
+    if(draw)draw_item_value(MIP_BURST_PULSES);
+}
+
+void TriggerMenu::set_burst_rate_value(bool draw)
+{
+    assign_rate(menu_items_[MIP_BURST_RATE].value, settings_.burst_rate_hz);
+    if(draw)draw_item_value(MIP_BURST_RATE);
+}
+
+void TriggerMenu::set_enable_trigger_value(bool draw)
+{
+    bool running = TriggerGenerator::instance().is_running();
+    menu_items_[MIP_ENABLE_TRIGGER].value = running ? ">ENABLE<" : "disable";
+    menu_items_[MIP_ENABLE_TRIGGER].value_style = running ? ANSI_INVERT : "";
+    if(draw)draw_item_value(MIP_ENABLE_TRIGGER);
+}
+
+std::vector<SimpleItemValueMenu::MenuItem> TriggerMenu::make_menu_items()
+{
+    std::vector<SimpleItemValueMenu::MenuItem> menu_items(MIP_NUM_ITEMS);
+    menu_items.at(MIP_STATUS)         = {"Status", 7, "OFF"};
+
+    menu_items.at(MIP_MODE)           = {"m       : Mode", 8, "Periodic"};
+    menu_items.at(MIP_RATE)           = {"f       : Rate (Hz)", 10, "10.000"};
+    menu_items.at(MIP_WIDTH)          = {"w       : Pulse width (ns)", 9, "1000"};
+    menu_items.at(MIP_BURST_PULSES)   = {"n       : Pulses per burst", 5, "10"};
+    menu_items.at(MIP_BURST_RATE)     = {"b       : Burst rate (Hz)", 10, "1.000"};
+    menu_items.at(MIP_ENABLE_TRIGGER) = {"E       : Enable / disable trigger", 8, "disable"};
+    menu_items.at(MIP_EXIT)           = {"Q       : Exit menu", 0, ""};
+    return menu_items;
+}
+
+bool TriggerMenu::controller_connected(int& return_code)
+{
+    return_code = 0;
+    return true;
+}
+
+bool TriggerMenu::controller_disconnected(int& return_code)
+{
+    return_code = 0;
+    return true;
+}
+
+bool TriggerMenu::input_rate(float& rate_hz, int iitem)
+{
+    SimpleItemValueRowAndColumnGetter rc_getter(this, iitem);
+    InplaceInputMenu input(rc_getter, 10, VI_POSITIVE_FLOAT, true, this);
+    if(input.event_loop()==1 and input.get_value().size()!=0) {
+        float val = std::stof(input.get_value());
+        if(val>=0.001 and val<=TriggerGenerator::max_rate_hz()) {
+            rate_hz = val;
+            return true;
+        } else {
+            beep();
+            input.cancelled();
+        }
+    } else {
+        input.cancelled();
+    }
+    return false;
+}
+
+bool TriggerMenu::process_key_press(int key, int key_count, int& return_code,
+    const std::vector<std::string>& escape_sequence_parameters, absolute_time_t& next_timer)
+{
+    // The generator keeps running with the old settings while they are
+    // edited, and the new ones take effect when it is next enabled
+    switch(key) {
+        case 'M':
+        case 'm':
+            settings_.mode = TriggerGenerator::Mode((settings_.mode + 1) % TriggerGenerator::MODE_NUM_MODES);
+            set_mode_value();
+            break;
+        case 'F':
+        case 'f':
+            input_rate(settings_.rate_hz, MIP_RATE);
+            set_rate_value();
+            break;
+        case 'W':
+        case 'w':
+            {
+                int width_ns = settings_.width_ns;
+                if(InplaceInputMenu::input_value_in_range(width_ns, 10, 100000000, this, MIP_WIDTH)) {
+                    settings_.width_ns = width_ns;
+                }
+                set_width_value();
+            }
+            break;
+        case 'N':
+        case 'n':
+            {
+                int burst_pulses = settings_.burst_pulses;
+                if(InplaceInputMenu::input_value_in_range(burst_pulses, 1,
+                        TriggerGenerator::poisson_pulses(), this, MIP_BURST_PULSES)) {
+                    settings_.burst_pulses = burst_pulses;
+                }
+                set_burst_pulses_value();
+            }
+            break;
+        case 'B':
+        case 'b':
+            input_rate(settings_.burst_rate_hz, MIP_BURST_RATE);
+            set_burst_rate_value();
+            break;
+        case 'E':
+            if(TriggerGenerator::instance().is_running()) {
+                stop_trigger();
+            } else {
+                start_trigger();
+            }
+            break;
+        case 'q':
+        case 'Q':
+            // Leave the generator running, so it can trigger the camera
+            // while the other menus are used
+            TriggerGenerator::instance().set_settings(settings_);
+            return_code = 0;
+            return false;
+
+        default:
+        if(key_count==1) {
+            beep();
+        }
+    }
+
+    return true;
+}
+
+bool TriggerMenu::process_timer(bool controller_is_connected, int& return_code, absolute_time_t& next_timer)
+{
+    heartbeat_timer_count_ += 1;
+    if(heartbeat_timer_count_ == 100) {
+        if(controller_is_connected) {
+            set_heartbeat(!heartbeat_);
+        }
+        heartbeat_timer_count_ = 0;
+    }
+    return true;
+}
+
+void TriggerMenu::start_trigger()
+{
+    if(not TriggerGenerator::instance().start(settings_)) {
+        beep();
+    }
+    set_status_value();
+    set_enable_trigger_value();
+}
+
+void TriggerMenu::stop_trigger()
+{
+    TriggerGenerator::instance().stop();
+    set_status_value();
+    set_enable_trigger_value();
+}
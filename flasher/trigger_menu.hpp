@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+
+#include <pico/stdlib.h>
+
+#include "flasher.hpp"
+#include "menu.hpp"
+#include "trigger_generator.hpp"
+
+class TriggerMenu: public SimpleItemValueMenu {
+public:
+    TriggerMenu();
+    virtual ~TriggerMenu() { }
+    bool controller_connected(int& return_code) final;
+    bool controller_disconnected(int& return_code) final;
+    bool process_key_press(int key, int key_count, int& return_code,
+        const std::vector<std::string>& escape_sequence_parameters, absolute_time_t& next_timer) final;
+    bool process_timer(bool controller_is_connected, int& return_code, absolute_time_t& next_timer) final;
+
+private:
+    enum MenuItemPositions {
+        MIP_STATUS,
+        MIP_EMPTY_LINE,
+        MIP_MODE,
+        MIP_RATE,
+        MIP_WIDTH,
+        MIP_BURST_PULSES,
+        MIP_BURST_RATE,
+        MIP_ENABLE_TRIGGER,
+        MIP_EXIT,
+        MIP_NUM_ITEMS // MUST BE LAST ITEM IN LIST
+    };
+
+    std::vector<MenuItem> make_menu_items();
+
+    void sync_values();
+    void set_status_value(bool draw = true);
+    void set_mode_value(bool draw = true);
+    void set_rate_value(bool draw = true);
+    void set_width_value(bool draw = true);
+    void set_burst_pulses_value(bool draw = true);
+    void set_burst_rate_value(bool draw = true);
+    void set_enable_trigger_value(bool draw = true);
+    bool input_rate(float& rate_hz, int iitem);
+    void start_trigger();
+    void stop_trigger();
+
+    TriggerGenerator::Settings settings_;
+    unsigned heartbeat_timer_count_ = 0;
+};
@@ -0,0 +1,207 @@
+#include <algorithm>
+
+#include <hardware/gpio.h>
+#include <hardware/clocks.h>
+
+#include "build_date.hpp"
+#include "flasher.hpp"
+#include "dac_write.hpp"
+#include "vdac_waveform.hpp"
+#include "vdac_out.pio.h"
+
+namespace {
+    static BuildDate build_date(__DATE__,__TIME__);
+
+    void dac_delay()
+    {
+        sleep_us(1);
+    }
+}
+
+uint32_t VDACWaveformEngine::min_step_us()
+{
+    return VDAC_OUT_HOLD_OVERHEAD;
+}
+
+void VDACWaveformEngine::configure_dac(int scale, int offset, int ar, int ac)
+{
+    gpio_put(DAC_EN_PIN, 0);
+    gpio_put(DAC_WR_PIN, 0);
+
+    // The DAC write engine leaves MAIN selected with the VDAC pins at zero
+    DACWriteEngine& dac_writer = DACWriteEngine::instance();
+    dac_writer.clear();
+    dac_writer.add_write(DACWriteEngine::DAC_SCALE, scale);
+    dac_writer.add_write(DACWriteEngine::DAC_TRIM, offset);
+    dac_writer.add_write(DACWriteEngine::DAC_MAIN, 0);
+    dac_writer.write_blocking();
+
+    gpio_put_masked(0x00000F << ROW_A_BASE_PIN, ar << ROW_A_BASE_PIN);
+    gpio_put_masked(0x00000F << COL_A_BASE_PIN, ac << COL_A_BASE_PIN);
+    dac_delay();
+    gpio_put(DAC_EN_PIN, 1);
+    gpio_put(DAC_WR_PIN, 1);
+    gpio_put(TRIG_PIN, 1);
+}
+
+void VDACWaveformEngine::unconfigure_dac()
+{
+    gpio_put(DAC_EN_PIN, 0);
+    gpio_put(DAC_WR_PIN, 0);
+    dac_delay();
+    gpio_put_masked(0x0000FF << VDAC_BASE_PIN, 0 << VDAC_BASE_PIN);
+    gpio_put_masked(0x00000F << ROW_A_BASE_PIN, 0 << ROW_A_BASE_PIN);
+    gpio_put_masked(0x00000F << COL_A_BASE_PIN, 0 << COL_A_BASE_PIN);
+    dac_delay();
+    gpio_put(TRIG_PIN, 0);
+}
+
+void VDACWaveformEngine::clear_waveform(int level)
+{
+    nrecord_ = 0;
+    record_end_us_ = 0;
+    level_ = level;
+}
+
+bool VDACWaveformEngine::add_record(int value, uint32_t until_us)
+{
+    // Extend the last record if it has the same value. A step too short for
+    // the state machine is dropped, the next value then starts a little
+    // early instead.
+    value = std::min(std::max(value, 0), 255);
+    if(nrecord_ > 0 and int(records_[nrecord_-1] & 0xFF) == value) {
+        uint32_t count = records_[nrecord_-1] >> 8;
+        uint32_t extra = std::min<uint32_t>(until_us - record_end_us_,
+            VDAC_OUT_MAX_HOLD_COUNT - count);
+        records_[nrecord_-1] = ((count + extra) << 8) | uint32_t(value);
+        record_end_us_ += extra;
+    }
+    while(until_us - record_end_us_ >= VDAC_OUT_HOLD_OVERHEAD) {
+        if(nrecord_ == max_records) {
+            return false;
+        }
+        uint32_t count = std::min<uint32_t>(until_us - record_end_us_ - VDAC_OUT_HOLD_OVERHEAD,
+            VDAC_OUT_MAX_HOLD_COUNT);
+        records_[nrecord_++] = (count << 8) | uint32_t(value);
+        record_end_us_ += count + VDAC_OUT_HOLD_OVERHEAD;
+    }
+    level_ = value;
+    return true;
+}
+
+bool VDACWaveformEngine::add_linear_segment(int level, uint32_t duration_us)
+{
+    // Value level_+k is held from step boundary k to k+1, boundaries being
+    // spread evenly through the segment, which ends on the new level
+    int v0 = level_;
+    int nstep = std::abs(level - v0);
+    int dv = level > v0 ? 1 : -1;
+    uint32_t start_us = record_end_us_;
+    for(int k=0; k<nstep; ++k) {
+        uint32_t boundary_us = start_us + uint32_t(uint64_t(duration_us) * (k+1) / nstep);
+        if(not add_record(v0 + dv*k, boundary_us)) {
+            return false;
+        }
+    }
+    if(nstep == 0) {
+        return add_hold(duration_us);
+    }
+    level_ = level;
+    return true;
+}
+
+bool VDACWaveformEngine::add_step(int level, uint32_t duration_us)
+{
+    return add_record(level, record_end_us_ + duration_us);
+}
+
+bool VDACWaveformEngine::add_hold(uint32_t duration_us)
+{
+    return add_record(level_, record_end_us_ + duration_us);
+}
+
+bool VDACWaveformEngine::add_samples(const uint8_t* samples, unsigned nsample, uint32_t sample_us)
+{
+    uint32_t start_us = record_end_us_;
+    for(unsigned i=0; i<nsample; ++i) {
+        if(not add_record(samples[i], start_us + (i+1)*sample_us)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool VDACWaveformEngine::play(unsigned repeat)
+{
+    if(running_) {
+        stop();
+    }
+    if(nrecord_ == 0 or repeat > max_repeat_table) {
+        return false;
+    }
+    repeat_ = repeat;
+
+    // The VDAC bus is shared with set_charges and dac_write, so stop() gives
+    // the pins back to whichever function had them
+    for(unsigned i=0; i<8; ++i) {
+        saved_function_[i] = gpio_get_function(VDAC_BASE_PIN + i);
+    }
+
+    transfer_.claim(pio1, &vdac_out_program);
+    vdac_out_program_init(transfer_.pio(), transfer_.sm(), transfer_.offset(), VDAC_BASE_PIN,
+        float(clock_get_hz(clk_sys)) / 1000000.0f);
+
+    // Each cycle after the first restarts from the next address in the
+    // table, the last being null, or loops on the first for ever
+    if(repeat == 0) {
+        repeat_table_[0] = records_;
+    } else {
+        for(unsigned i=0; i+1<repeat; ++i) {
+            repeat_table_[i] = records_;
+        }
+        repeat_table_[repeat-1] = nullptr;
+    }
+    start_time_ = get_absolute_time();
+    transfer_.start_looped(records_, nrecord_, repeat_table_, repeat != 0);
+    running_ = true;
+    return true;
+}
+
+void VDACWaveformEngine::stop()
+{
+    if(not running_) {
+        return;
+    }
+    transfer_.release();
+    for(unsigned i=0; i<8; ++i) {
+        gpio_set_function(VDAC_BASE_PIN + i, saved_function_[i]);
+    }
+    running_ = false;
+}
+
+bool VDACWaveformEngine::is_running()
+{
+    if(running_ and repeat_ != 0
+            and elapsed_us() >= uint64_t(record_end_us_) * repeat_
+            and transfer_.is_finished()) {
+        stop();
+    }
+    return running_;
+}
+
+uint64_t VDACWaveformEngine::elapsed_us()
+{
+    if(not running_) {
+        return 0;
+    }
+    return absolute_time_diff_us(start_time_, get_absolute_time());
+}
+
+uint64_t VDACWaveformEngine::completed_cycles()
+{
+    if(record_end_us_ == 0) {
+        return 0;
+    }
+    uint64_t cycles = elapsed_us() / record_end_us_;
+    return repeat_ ? std::min<uint64_t>(cycles, repeat_) : cycles;
+}
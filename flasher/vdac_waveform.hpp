@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+
+#include <pico/time.h>
+#include <hardware/gpio.h>
+
+#include "pio_dma_transfer.hpp"
+
+// Plays waveforms on the VDAC bus out of a table of (value, hold time)
+// records, which DMA feeds to the vdac_out state machine. Waveforms are built
+// into the table before they are played, from piecewise-linear segments or
+// from tables of samples. The time of each step is computed from the start of
+// the waveform, so rounding the hold times to whole microseconds never
+// accumulates, and the timing does not depend on the menu loop or on terminal
+// traffic. A second DMA channel restarts the first at the end of each cycle,
+// so waveforms are repeated or looped without the CPU. The menus only read
+// back the progress.
+class VDACWaveformEngine
+{
+public:
+    // Building the waveform, the level starts at "level" and each function
+    // continues from where the last left it. They return false once the
+    // table is full.
+    void clear_waveform(int level = 0);
+    bool add_linear_segment(int level, uint32_t duration_us);
+    bool add_step(int level, uint32_t duration_us);
+    bool add_hold(uint32_t duration_us);
+    bool add_samples(const uint8_t* samples, unsigned nsample, uint32_t sample_us);
+    uint32_t waveform_duration_us() const { return record_end_us_; }
+    unsigned waveform_records() const { return nrecord_; }
+
+    // Play the waveform "repeat" times, or until stopped if "repeat" is zero
+    bool play(unsigned repeat = 1);
+    void stop();
+    bool is_running();
+
+    uint64_t elapsed_us();
+    uint64_t completed_cycles();
+
+    // Set the scale and offset DACs, select the LED and enable it, ready
+    // for a waveform to be played on the VDAC bus, and undo it afterwards
+    static void configure_dac(int scale, int offset, int ar, int ac);
+    static void unconfigure_dac();
+
+    // Shortest time that a step can be held, steps that would be shorter are
+    // merged into the ones that follow them
+    static uint32_t min_step_us();
+    static unsigned max_repeat() { return max_repeat_table; }
+    static unsigned max_steps() { return max_records; }
+
+    static VDACWaveformEngine& instance() {
+        static VDACWaveformEngine the_singleton;
+        return the_singleton;
+    }
+private:
+    VDACWaveformEngine() { }
+    VDACWaveformEngine(VDACWaveformEngine&);
+    VDACWaveformEngine& operator=(VDACWaveformEngine const&);
+
+    bool add_record(int value, uint32_t until_us);
+
+    static const unsigned max_records = 4096;
+    static const unsigned max_repeat_table = 256;
+
+    PIODMATransfer transfer_;
+    bool running_ = false;
+    unsigned repeat_ = 1;
+    absolute_time_t start_time_ = nil_time;
+    gpio_function_t saved_function_[8];
+
+    uint32_t records_[max_records];
+    unsigned nrecord_ = 0;
+    uint32_t record_end_us_ = 0; // time at which the last record ends
+    int level_ = 0;
+
+    // Read addresses that the control channel writes to the data channel at
+    // the end of each cycle, null to stop
+    const uint32_t* repeat_table_[max_repeat_table];
+};
@@ -0,0 +1,320 @@
+#include <algorithm>
+
+#include <cstring>
+#include <cstdio>
+
+#include "build_date.hpp"
+#include "virtual_screen.hpp"
+
+namespace {
+    static BuildDate build_date(__DATE__,__TIME__);
+
+    // CSI sequence with a single count, which is left out when it is one
+    int format_csi(char* buffer, int n, char final)
+    {
+        if(n == 1) {
+            return sprintf(buffer, "\033[%c", final);
+        } else {
+            return sprintf(buffer, "\033[%d%c", n, final);
+        }
+    }
+}
+
+VirtualScreen::VirtualScreen(int h, int w)
+{
+    set_size(h, w);
+}
+
+void VirtualScreen::set_enabled(bool enabled)
+{
+    enabled_ = enabled;
+    update_active();
+}
+
+void VirtualScreen::set_size(int h, int w)
+{
+    h_ = std::max(std::min(h, max_height), 1);
+    w_ = std::max(std::min(w, max_width), 1);
+    r_ = std::min(r_, h_-1);
+    c_ = std::min(c_, w_-1);
+    clear();
+    clear_overlay();
+    invalidate();
+    update_active();
+}
+
+void VirtualScreen::update_active()
+{
+    bool active = enabled_;
+    if(active and not active_) {
+        // Terminal was written to directly while we were not looking
+        invalidate();
+    }
+    active_ = active;
+}
+
+void VirtualScreen::clear()
+{
+    for(int r=0; r<h_; ++r) {
+        memset(want_[r], ' ', w_);
+    }
+}
+
+void VirtualScreen::line_feed()
+{
+    if(r_+1 < h_) {
+        ++r_;
+    } else {
+        for(int r=1; r<h_; ++r) {
+            memcpy(want_[r-1], want_[r], w_);
+        }
+        memset(want_[h_-1], ' ', w_);
+    }
+}
+
+void VirtualScreen::put(int c)
+{
+    switch(parse_state_) {
+    case PS_TEXT:
+        if(c == '\033') {
+            parse_state_ = PS_ESCAPE;
+        } else if(c == '\r') {
+            c_ = 0;
+        } else if(c == '\n') {
+            line_feed();
+        } else if(c == '\b') {
+            c_ = std::max(std::min(c_, w_-1)-1, 0);
+        } else if(c >= ' ' and c < 0x7F) {
+            if(c_ < w_) {
+                want_[r_][c_++] = c | (invert_ ? cell_invert : 0);
+            }
+        }
+        break;
+    case PS_ESCAPE:
+        if(c == '[') {
+            parse_state_ = PS_CSI;
+            csi_nparam_ = 0;
+            csi_private_ = false;
+        } else {
+            if(c == '7') {
+                saved_r_ = r_;
+                saved_c_ = c_;
+                saved_invert_ = invert_;
+            } else if(c == '8') {
+                r_ = saved_r_;
+                c_ = saved_c_;
+                invert_ = saved_invert_;
+            }
+            parse_state_ = PS_TEXT;
+        }
+        break;
+    case PS_CSI:
+        if(c >= '0' and c <= '9') {
+            if(csi_nparam_ == 0) {
+                csi_params_[csi_nparam_++] = 0;
+            }
+            if(csi_nparam_ <= max_csi_params) {
+                csi_params_[csi_nparam_-1] = csi_params_[csi_nparam_-1]*10 + (c-'0');
+            }
+        } else if(c == ';') {
+            if(csi_nparam_ == 0) {
+                csi_params_[csi_nparam_++] = 0;
+            }
+            if(++csi_nparam_ <= max_csi_params) {
+                csi_params_[csi_nparam_-1] = 0;
+            }
+        } else if(c == '?') {
+            csi_private_ = true;
+        } else if(c >= 0x40 and c <= 0x7E) {
+            if(not csi_private_) {
+                execute_csi(c);
+            }
+            parse_state_ = PS_TEXT;
+        }
+        break;
+    }
+}
+
+void VirtualScreen::execute_csi(char final)
+{
+    int nparam = std::min(csi_nparam_, max_csi_params);
+    int p0 = nparam > 0 ? csi_params_[0] : 0;
+    int p1 = nparam > 1 ? csi_params_[1] : 0;
+    switch(final) {
+    case 'H':
+    case 'f':
+        r_ = std::min(std::max(p0, 1), h_) - 1;
+        c_ = std::min(std::max(p1, 1), w_) - 1;
+        break;
+    case 'J':
+        if(p0 == 2) {
+            clear();
+        }
+        break;
+    case 'm':
+        if(nparam == 0) {
+            invert_ = false;
+        }
+        for(int i=0; i<nparam; ++i) {
+            if(csi_params_[i] == 0 or csi_params_[i] == 27) {
+                invert_ = false;
+            } else if(csi_params_[i] == 7) {
+                invert_ = true;
+            }
+        }
+        break;
+    default:
+        // nothing to see here
+        break;
+    }
+}
+
+void VirtualScreen::set_overlay(int r, int c, const char* text, unsigned n, bool invert)
+{
+    if(r < 0 or r >= h_ or c < 0 or c >= w_) {
+        overlay_n_ = 0;
+        return;
+    }
+    overlay_r_ = r;
+    overlay_c_ = c;
+    overlay_n_ = std::min(int(n), w_-c);
+    for(int i=0; i<overlay_n_; ++i) {
+        overlay_[i] = text[i] | (invert ? cell_invert : 0);
+    }
+}
+
+void VirtualScreen::set_terminal_invert(bool invert, Sink out)
+{
+    if(invert != term_invert_) {
+        for(const char* s = invert ? "\033[7m" : "\033[m"; *s; ++s) {
+            out(*s);
+        }
+        term_invert_ = invert;
+    }
+}
+
+void VirtualScreen::move_terminal_cursor(int r, int c, Sink out)
+{
+    if(r == term_r_ and c == term_c_) {
+        return;
+    }
+
+    char abs_move[32];
+    int nabs = sprintf(abs_move, "\033[%d;%dH", r+1, c+1);
+    const char* move = abs_move;
+    int nmove = nabs;
+
+    char rel_move[32];
+    if(term_r_ >= 0) {
+        int nrel = 0;
+        if(r > term_r_) {
+            nrel += format_csi(rel_move+nrel, r-term_r_, 'B');
+        } else if(r < term_r_) {
+            nrel += format_csi(rel_move+nrel, term_r_-r, 'A');
+        }
+        if(c == 0 and term_c_ != 0) {
+            rel_move[nrel++] = '\r';
+        } else if(c > term_c_) {
+            // Over a short gap it is cheaper to write the cells again than
+            // to skip them, provided they have the attribute already set
+            int gap = c - term_c_;
+            char skip[16];
+            int nskip = format_csi(skip, gap, 'C');
+            bool rewrite = gap <= nskip;
+            for(int ic=term_c_; rewrite and ic<c; ++ic) {
+                rewrite = bool(have_[r][ic] & cell_invert) == term_invert_;
+            }
+            if(rewrite) {
+                for(int ic=term_c_; ic<c; ++ic) {
+                    rel_move[nrel++] = have_[r][ic] & ~cell_invert;
+                }
+            } else {
+                memcpy(rel_move+nrel, skip, nskip);
+                nrel += nskip;
+            }
+        } else if(c < term_c_) {
+            int gap = term_c_ - c;
+            char back[16];
+            int nback = format_csi(back, gap, 'D');
+            if(gap <= nback) {
+                memset(rel_move+nrel, '\b', gap);
+                nrel += gap;
+            } else {
+                memcpy(rel_move+nrel, back, nback);
+                nrel += nback;
+            }
+        }
+        if(nrel < nabs) {
+            move = rel_move;
+            nmove = nrel;
+        }
+    }
+
+    for(int i=0; i<nmove; ++i) {
+        out(move[i]);
+    }
+    term_r_ = r;
+    term_c_ = c;
+}
+
+bool VirtualScreen::row_is_blank_from(int r, int c) const
+{
+    for(; c<w_; ++c) {
+        if(cell(r, c) != ' ')return false;
+    }
+    return true;
+}
+
+void VirtualScreen::render(Sink out)
+{
+    if(not active_) {
+        return;
+    }
+
+    if(clear_pending_) {
+        for(const char* s = "\033[m\033[H\033[2J"; *s; ++s) {
+            out(*s);
+        }
+        for(int r=0; r<h_; ++r) {
+            memset(have_[r], ' ', w_);
+        }
+        term_r_ = 0;
+        term_c_ = 0;
+        term_invert_ = false;
+        clear_pending_ = false;
+    }
+
+    for(int r=0; r<h_; ++r) {
+        for(int c=0; c<w_; ++c) {
+            uint8_t cell = this->cell(r, c);
+            if(cell == have_[r][c]) {
+                continue;
+            }
+            if(cell == ' ' and row_is_blank_from(r, c)) {
+                // Erase the rest of the line in one go if that is shorter
+                int nchanged = 0;
+                for(int ic=c; ic<w_; ++ic) {
+                    nchanged += (have_[r][ic] != ' ');
+                }
+                if(nchanged > 3) {
+                    move_terminal_cursor(r, c, out);
+                    set_terminal_invert(false, out);
+                    out('\033'); out('['); out('K');
+                    memset(have_[r]+c, ' ', w_-c);
+                    break;
+                }
+            }
+            move_terminal_cursor(r, c, out);
+            set_terminal_invert(cell & cell_invert, out);
+            out(cell & ~cell_invert);
+            have_[r][c] = cell;
+            if(++term_c_ == w_) {
+                // Terminals differ in where they leave the cursor after
+                // writing to the last column, so stop relying on it
+                term_r_ = -1;
+            }
+        }
+    }
+
+    move_terminal_cursor(r_, std::min(c_, w_-1), out);
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+
+// Off-screen copy of the terminal that the menus draw into. Characters and
+// the escape sequences the menus use (cursor position, save and restore
+// cursor, clear screen, inverse video) are interpreted into a grid of cells
+// rather than sent to the terminal. A second grid holds what the terminal is
+// showing, and render() sends only the cells that differ between the two,
+// moving the cursor with whichever of the relative or absolute sequences is
+// shortest. Repainting a menu that has not changed therefore sends nothing.
+class VirtualScreen {
+public:
+    typedef int (*Sink)(int c);
+
+    static constexpr int max_height = 60;
+    static constexpr int max_width = 132;
+
+    VirtualScreen(int h, int w);
+
+    // The screen is only used while it is enabled, otherwise output should
+    // go straight to the terminal. A terminal larger than the grid is only
+    // used over its top-left max_height by max_width cells, which the menus
+    // keep within.
+    bool active() const { return active_; }
+    void set_enabled(bool enabled);
+    void set_size(int h, int w);
+
+    // Forget what the terminal is showing, so that the next render clears
+    // it and draws every cell again
+    void invalidate() { clear_pending_ = true; }
+
+    void put(int c);
+    void render(Sink out);
+
+    // Single line of text shown on top of whatever has been drawn, until it
+    // is cleared, so that transient messages need not be drawn over and
+    // then drawn back
+    void set_overlay(int r, int c, const char* text, unsigned n, bool invert);
+    void clear_overlay() { overlay_n_ = 0; }
+
+private:
+    enum ParseState { PS_TEXT, PS_ESCAPE, PS_CSI };
+
+    static constexpr uint8_t cell_invert = 0x80;
+    static constexpr int max_csi_params = 2;
+
+    void update_active();
+    void clear();
+    void line_feed();
+    void execute_csi(char final);
+    void move_terminal_cursor(int r, int c, Sink out);
+    void set_terminal_invert(bool invert, Sink out);
+    bool row_is_blank_from(int r, int c) const;
+    uint8_t cell(int r, int c) const {
+        return (r == overlay_r_ and c >= overlay_c_ and c < overlay_c_+overlay_n_) ?
+            overlay_[c-overlay_c_] : want_[r][c]; }
+
+    uint8_t want_[max_height][max_width]; // what the menus have drawn
+    uint8_t have_[max_height][max_width]; // what the terminal is showing
+
+    int h_ = 0;
+    int w_ = 0;
+    bool enabled_ = true;
+    bool active_ = false;
+    bool clear_pending_ = true;
+
+    uint8_t overlay_[max_width];
+    int overlay_r_ = 0;
+    int overlay_c_ = 0;
+    int overlay_n_ = 0;
+
+    // Cursor and attribute as seen by the menus
+    int r_ = 0;
+    int c_ = 0;
+    bool invert_ = false;
+    int saved_r_ = 0;
+    int saved_c_ = 0;
+    bool saved_invert_ = false;
+
+    ParseState parse_state_ = PS_TEXT;
+    int csi_params_[max_csi_params];
+    int csi_nparam_ = 0;
+    bool csi_private_ = false;
+
+    // Cursor and attribute of the terminal itself, row is -1 when unknown
+    int term_r_ = -1;
+    int term_c_ = 0;
+    bool term_invert_ = false;
+};
@@ -0,0 +1,432 @@
+#include <cmath>
+
+#include "build_date.hpp"
+#include "menu.hpp"
+#include "input_menu.hpp"
+#include "waveform_menu.hpp"
+#include "vdac_waveform.hpp"
+
+namespace {
+    static BuildDate build_date(__DATE__,__TIME__);
+
+    // Samples of the waveforms computed from tables, and of the user table,
+    // which is kept between visits to the menu
+    uint8_t waveform_samples[1024];
+    uint8_t user_samples[1024];
+    unsigned num_user_samples = 0;
+}
+
+WaveformMenu::WaveformMenu() :
+    SimpleItemValueMenu(make_menu_items(), "Waveform menu")
+{
+    sync_values();
+}
+
+void WaveformMenu::sync_values()
+{
+    unsigned all_gpio = gpio_get_all();
+    vdac_ = (all_gpio >> VDAC_BASE_PIN)  & 0x0000FF;
+    ar_   = (all_gpio >> ROW_A_BASE_PIN) & 0x00000F;
+    ac_   = (all_gpio >> COL_A_BASE_PIN) & 0x00000F;
+    set_scale_value(false);
+    set_rc_value(false);
+    set_user_table_value(false);
+}
+
+void WaveformMenu::set_rc_value(bool draw)
+{
+    rc_to_value_string(menu_items_[MIP_ROWCOL].value, ar_, ac_);
+    if(draw)draw_item_value(MIP_ROWCOL);
+}
+
+void WaveformMenu::set_scale_value(bool draw)
+{
+    menu_items_[MIP_SCALE_DAC].value.assign_int(scale_);
+    if(draw)draw_item_value(MIP_SCALE_DAC);
+}
+
+void WaveformMenu::set_offset_value(bool draw)
+{
+    menu_items_[MIP_TRIM_DAC].value.assign_int(offset_);
+    if(draw)draw_item_value(MIP_TRIM_DAC);
+}
+
+void WaveformMenu::set_waveform_value(bool draw)
+{
+    static const char* name[]= {"Sine", "Exp decay", "Step train", "Triangle", "User table"};
+    menu_items_[MIP_WAVEFORM].value = name[waveform_];
+    if(draw)draw_item_value(MIP_WAVEFORM);
+}
+
+void WaveformMenu::set_period_value(bool draw)
+{
+    menu_items_[MIP_PERIOD].value.assign_fixed(std::lround(period_*1000), 3);
+    if(draw)draw_item_value(MIP_PERIOD);
+}
+
+void WaveformMenu::set_sample_clock_value(bool draw)
+{
+    menu_items_[MIP_SAMPLE_CLOCK].value.assign_int(sample_clock_us_);
+    if(draw)draw_item_value(MIP_SAMPLE_CLOCK);
+}
+
+void WaveformMenu::set_low_level_value(bool draw)
+{
+    menu_items_[MIP_LOW_LEVEL].value.assign_int(low_level_);
+    if(draw)draw_item_value(MIP_LOW_LEVEL);
+}
+
+void WaveformMenu::set_high_level_value(bool draw)
+{
+    menu_items_[MIP_HIGH_LEVEL].value.assign_int(high_level_);
+    if(draw)draw_item_value(MIP_HIGH_LEVEL);
+}
+
+void WaveformMenu::set_num_steps_value(bool draw)
+{
+    menu_items_[MIP_NUM_STEPS].value.assign_int(num_steps_);
+    if(draw)draw_item_value(MIP_NUM_STEPS);
+}
+
+void WaveformMenu::set_repeat_value(bool draw)
+{
+    if(repeat_ == 0) {
+        menu_items_[MIP_REPEAT].value = "loop";
+    } else {
+        menu_items_[MIP_REPEAT].value.assign_int(repeat_);
+    }
+    if(draw)draw_item_value(MIP_REPEAT);
+}
+
+void WaveformMenu::set_user_table_value(bool draw)
+{
+    menu_items_[MIP_USER_TABLE].value.assign_int(num_user_samples);
+    if(draw)draw_item_value(MIP_USER_TABLE);
+}
+
+void WaveformMenu::set_enable_waveform_value(bool draw)
+{
+    menu_items_[MIP_ENABLE_WAVEFORM].value = enable_waveform_ ? ">PLAY<" : "stop";
+    menu_items_[MIP_ENABLE_WAVEFORM].value_style = enable_waveform_ ? ANSI_INVERT : "";
+    if(draw)draw_item_value(MIP_ENABLE_WAVEFORM);
+}
+
+void WaveformMenu::set_status_value(bool draw)
+{
+    menu_items_[MIP_STATUS].value = enable_waveform_ ? "PLAYING" : "OFF";
+    if(draw)draw_item_value(MIP_STATUS);
+}
+
+void WaveformMenu::set_cycle_value(bool draw)
+{
+    menu_items_[MIP_CYCLE].value.assign_int(cycle_);
+    if(draw)draw_item_value(MIP_CYCLE);
+}
+
+void WaveformMenu::set_time_value(bool draw)
+{
+    menu_items_[MIP_TIME].value.assign_fixed(time_ms_, 3);
+    if(draw)draw_item_value(MIP_TIME);
+}
+
+void WaveformMenu::set_vdac_value(bool draw)
+{
+    menu_items_[MIP_VDAC].value.assign_int(vdac_);
+    if(draw)draw_item_value(MIP_VDAC);
+}
+
+std::vector<SimpleItemValueMenu::MenuItem> WaveformMenu::make_menu_items()
+{
+    std::vector<SimpleItemValueMenu::MenuItem> menu_items(MIP_NUM_ITEMS);
+    menu_items.at(MIP_STATUS)          = {"Status", 7, "OFF"};
+    menu_items.at(MIP_CYCLE)           = {"Cycle", 8, "0"};
+    menu_items.at(MIP_TIME)            = {"Time (s)", 8, "0.000"};
+    menu_items.at(MIP_VDAC)            = {"Intensity", 3, "0"};
+
+    menu_items.at(MIP_ROWCOL)          = {"Cursors : Change column & row", 3, "A1"};
+    menu_items.at(MIP_SCALE_DAC)       = {"</s/>   : Waveform scale", 3, "0"};
+    menu_items.at(MIP_TRIM_DAC)        = {"-/o/+   : Waveform offset", 3, "0"};
+    menu_items.at(MIP_WAVEFORM)        = {"w       : Waveform", 10, "Sine"};
+    menu_items.at(MIP_PERIOD)          = {"p       : Period (s)", 8, "1.000"};
+    menu_items.at(MIP_SAMPLE_CLOCK)    = {"c       : Sample clock (us)", 6, "1000"};
+    menu_items.at(MIP_LOW_LEVEL)       = {"l       : Low level", 3, "0"};
+    menu_items.at(MIP_HIGH_LEVEL)      = {"h       : High level", 3, "255"};
+    menu_items.at(MIP_NUM_STEPS)       = {"n       : Steps in step train", 3, "8"};
+    menu_items.at(MIP_REPEAT)          = {"r       : Repeats (0 to loop)", 4, "loop"};
+    menu_items.at(MIP_USER_TABLE)      = {"U       : Upload user table", 4, "0"};
+    menu_items.at(MIP_ENABLE_WAVEFORM) = {"E       : Play / stop waveform", 6, "stop"};
+    menu_items.at(MIP_EXIT)            = {"Q       : Exit menu", 0, ""};
+    return menu_items;
+}
+
+void WaveformMenu::event_loop_finishing(int& return_code)
+{
+    // Nothing polls the engine once the menu has gone, so stop the waveform
+    // however the menu is left
+    if(enable_waveform_) {
+        VDACWaveformEngine::instance().stop();
+        VDACWaveformEngine::unconfigure_dac();
+        enable_waveform_ = false;
+    }
+}
+
+bool WaveformMenu::controller_connected(int& return_code)
+{
+    return_code = 0;
+    return true;
+}
+
+bool WaveformMenu::controller_disconnected(int& return_code)
+{
+    return_code = 0;
+    return true;
+}
+
+bool WaveformMenu::process_key_press(int key, int key_count, int& return_code,
+    const std::vector<std::string>& escape_sequence_parameters, absolute_time_t& next_timer)
+{
+    if(enable_waveform_ == true) {
+        switch(key) {
+            case 'E':
+                stop_waveform();
+                break;
+            case 'q':
+            case 'Q':
+                return_code = 0;
+                return false;
+            default:
+                beep();
+        }
+        return true;
+    }
+
+    if(process_rc_keys(ar_, ac_, key, key_count)) {
+        set_rc_value();
+        return true;
+    }
+
+    switch(key) {
+        case '<':
+            decrease_value_in_range(scale_, 0, (key_count >= 15 ? 5 : 1), key_count==1);
+            set_scale_value();
+            break;
+        case '>':
+            increase_value_in_range(scale_, 255, (key_count >= 15 ? 5 : 1), key_count==1);
+            set_scale_value();
+            break;
+        case 'S':
+        case 's':
+            InplaceInputMenu::input_value_in_range(scale_, 0, 255, this, MIP_SCALE_DAC);
+            set_scale_value();
+            break;
+        case '-':
+            decrease_value_in_range(offset_, 0, (key_count >= 15 ? 5 : 1), key_count==1);
+            set_offset_value();
+            break;
+        case '+':
+            increase_value_in_range(offset_, 255, (key_count >= 15 ? 5 : 1), key_count==1);
+            set_offset_value();
+            break;
+        case 'O':
+        case 'o':
+            InplaceInputMenu::input_value_in_range(offset_, 0, 255, this, MIP_TRIM_DAC);
+            set_offset_value();
+            break;
+        case 'W':
+        case 'w':
+            waveform_ = (waveform_ + 1) % WT_NUM_TYPES;
+            set_waveform_value();
+            break;
+        case 'P':
+        case 'p':
+            {
+                SimpleItemValueRowAndColumnGetter rc_getter(this, MIP_PERIOD);
+                InplaceInputMenu input(rc_getter, 7, VI_POSITIVE_FLOAT, true, this);
+                if(input.event_loop()==1 and input.get_value().size()!=0) {
+                    float val = std::stof(input.get_value());
+                    if(val>=0.001 and val<=1000) {
+                        period_ = val;
+                    } else {
+                        beep();
+                        input.cancelled();
+                    }
+                } else {
+                    input.cancelled();
+                }
+                set_period_value(true);
+            }
+            break;
+        case 'C':
+        case 'c':
+            InplaceInputMenu::input_value_in_range(sample_clock_us_,
+                VDACWaveformEngine::min_step_us(), 999999, this, MIP_SAMPLE_CLOCK);
+            set_sample_clock_value();
+            break;
+        case 'L':
+        case 'l':
+            InplaceInputMenu::input_value_in_range(low_level_, 0, 255, this, MIP_LOW_LEVEL);
+            set_low_level_value();
+            break;
+        case 'H':
+        case 'h':
+            InplaceInputMenu::input_value_in_range(high_level_, 0, 255, this, MIP_HIGH_LEVEL);
+            set_high_level_value();
+            break;
+        case 'N':
+        case 'n':
+            InplaceInputMenu::input_value_in_range(num_steps_, 1, 256, this, MIP_NUM_STEPS);
+            set_num_steps_value();
+            break;
+        case 'R':
+        case 'r':
+            InplaceInputMenu::input_value_in_range(repeat_, 0,
+                VDACWaveformEngine::max_repeat(), this, MIP_REPEAT);
+            set_repeat_value();
+            break;
+        case 'U':
+            upload_user_table();
+            break;
+        case 'E':
+            start_waveform();
+            break;
+        case 'q':
+        case 'Q':
+            return_code = 0;
+            return false;
+
+        default:
+        if(key_count==1) {
+            beep();
+        }
+    }
+
+    return true;
+}
+
+bool WaveformMenu::process_timer(bool controller_is_connected, int& return_code, absolute_time_t& next_timer)
+{
+    heartbeat_timer_count_ += 1;
+    if(heartbeat_timer_count_ == 100) {
+        if(controller_is_connected) {
+            set_heartbeat(!heartbeat_);
+        }
+        heartbeat_timer_count_ = 0;
+    }
+
+    if(enable_waveform_) {
+        if(not VDACWaveformEngine::instance().is_running()) {
+            stop_waveform();
+        } else if(++progress_timer_count_ >= progress_display_ticks()) {
+            update_waveform_progress();
+            progress_timer_count_ = 0;
+        }
+    }
+    return true;
+}
+
+void WaveformMenu::upload_user_table()
+{
+    int nsample = InputMenu::input_byte_table(user_samples, max_table_samples(),
+        "Upload user table", this);
+    if(nsample >= 0) {
+        num_user_samples = nsample;
+    }
+    this->redraw();
+    set_user_table_value();
+}
+
+bool WaveformMenu::build_waveform()
+{
+    VDACWaveformEngine& engine = VDACWaveformEngine::instance();
+    uint32_t period_us = std::lround(period_*1e6);
+    unsigned nsample = period_us / sample_clock_us_;
+    if(waveform_ == WT_SINE or waveform_ == WT_EXP_DECAY) {
+        if(nsample == 0 or nsample > max_table_samples()) {
+            return false;
+        }
+    }
+
+    engine.clear_waveform(low_level_);
+    switch(waveform_) {
+    case WT_SINE:
+        for(unsigned i=0; i<nsample; ++i) {
+            float x = 0.5f - 0.5f*std::cos(float(2*M_PI) * i / nsample);
+            waveform_samples[i] = std::lround(low_level_ + (high_level_-low_level_)*x);
+        }
+        return engine.add_samples(waveform_samples, nsample, sample_clock_us_);
+    case WT_EXP_DECAY:
+        // Decays by e^5 over the period, starting from the high level
+        for(unsigned i=0; i<nsample; ++i) {
+            float x = std::exp(-5.0f * i / nsample);
+            waveform_samples[i] = std::lround(low_level_ + (high_level_-low_level_)*x);
+        }
+        return engine.add_samples(waveform_samples, nsample, sample_clock_us_);
+    case WT_STEP_TRAIN:
+        for(int k=0; k<num_steps_; ++k) {
+            int level = num_steps_ == 1 ? high_level_ :
+                low_level_ + (high_level_-low_level_)*k/(num_steps_-1);
+            uint32_t t0 = uint64_t(period_us)*k/num_steps_;
+            uint32_t t1 = uint64_t(period_us)*(k+1)/num_steps_;
+            if(not engine.add_step(level, t1-t0)) {
+                return false;
+            }
+        }
+        return true;
+    case WT_TRIANGLE:
+        return engine.add_linear_segment(high_level_, period_us/2)
+            and engine.add_linear_segment(low_level_, period_us - period_us/2);
+    case WT_USER_TABLE:
+        if(num_user_samples == 0) {
+            return false;
+        }
+        return engine.add_samples(user_samples, num_user_samples, sample_clock_us_);
+    default:
+        return false;
+    }
+}
+
+void WaveformMenu::start_waveform()
+{
+    if(not build_waveform()) {
+        beep();
+        return;
+    }
+    VDACWaveformEngine::configure_dac(scale_, offset_, ar_, ac_);
+    if(not VDACWaveformEngine::instance().play(repeat_)) {
+        VDACWaveformEngine::unconfigure_dac();
+        beep();
+        return;
+    }
+    enable_waveform_ = true;
+    progress_timer_count_ = 0;
+    set_enable_waveform_value();
+    set_status_value();
+    update_waveform_progress();
+}
+
+void WaveformMenu::stop_waveform()
+{
+    VDACWaveformEngine::instance().stop();
+    enable_waveform_ = false;
+    cycle_ = 0;
+    time_ms_ = 0;
+    vdac_ = 0;
+    gpio_put_masked(0x0000FF << VDAC_BASE_PIN, vdac_ << VDAC_BASE_PIN);
+    VDACWaveformEngine::unconfigure_dac();
+    set_enable_waveform_value();
+    set_status_value();
+    set_cycle_value();
+    set_time_value();
+    set_vdac_value();
+}
+
+void WaveformMenu::update_waveform_progress()
+{
+    VDACWaveformEngine& engine = VDACWaveformEngine::instance();
+    cycle_ = engine.completed_cycles();
+    time_ms_ = engine.elapsed_us() / 1000;
+    vdac_ = (gpio_get_all() >> VDAC_BASE_PIN) & 0x0000FF;
+    set_cycle_value();
+    set_time_value();
+    set_vdac_value();
+}
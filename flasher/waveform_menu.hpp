@@ -0,0 +1,97 @@
+#pragma once
+
+#include <vector>
+
+#include <pico/stdlib.h>
+
+#include "flasher.hpp"
+#include "menu.hpp"
+
+class WaveformMenu: public SimpleItemValueMenu {
+public:
+    WaveformMenu();
+    virtual ~WaveformMenu() { }
+    void event_loop_finishing(int& return_code) final;
+    bool controller_connected(int& return_code) final;
+    bool controller_disconnected(int& return_code) final;
+    bool process_key_press(int key, int key_count, int& return_code,
+        const std::vector<std::string>& escape_sequence_parameters, absolute_time_t& next_timer) final;
+    bool process_timer(bool controller_is_connected, int& return_code, absolute_time_t& next_timer) final;
+
+private:
+    enum MenuItemPositions {
+        MIP_STATUS,
+        MIP_CYCLE,
+        MIP_TIME,
+        MIP_VDAC,
+        MIP_EMPTY_LINE,
+        MIP_ROWCOL,
+        MIP_SCALE_DAC,
+        MIP_TRIM_DAC,
+        MIP_WAVEFORM,
+        MIP_PERIOD,
+        MIP_SAMPLE_CLOCK,
+        MIP_LOW_LEVEL,
+        MIP_HIGH_LEVEL,
+        MIP_NUM_STEPS,
+        MIP_REPEAT,
+        MIP_USER_TABLE,
+        MIP_ENABLE_WAVEFORM,
+        MIP_EXIT,
+        MIP_NUM_ITEMS // MUST BE LAST ITEM IN LIST
+    };
+
+    enum WaveformType {
+        WT_SINE,
+        WT_EXP_DECAY,
+        WT_STEP_TRAIN,
+        WT_TRIANGLE,
+        WT_USER_TABLE,
+        WT_NUM_TYPES // MUST BE LAST ITEM IN LIST
+    };
+
+    std::vector<MenuItem> make_menu_items();
+
+    void sync_values();
+    void set_rc_value(bool draw = true);
+    void set_scale_value(bool draw = true);
+    void set_offset_value(bool draw = true);
+    void set_waveform_value(bool draw = true);
+    void set_period_value(bool draw = true);
+    void set_sample_clock_value(bool draw = true);
+    void set_low_level_value(bool draw = true);
+    void set_high_level_value(bool draw = true);
+    void set_num_steps_value(bool draw = true);
+    void set_repeat_value(bool draw = true);
+    void set_user_table_value(bool draw = true);
+    void set_enable_waveform_value(bool draw = true);
+    void set_status_value(bool draw = true);
+    void set_cycle_value(bool draw = true);
+    void set_time_value(bool draw = true);
+    void set_vdac_value(bool draw = true);
+    void upload_user_table();
+    bool build_waveform();
+    void start_waveform();
+    void stop_waveform();
+    void update_waveform_progress();
+    static unsigned progress_display_ticks() { return 10; } // 10Hz
+    static unsigned max_table_samples() { return 1024; }
+
+    int scale_ = 0;
+    int offset_ = 0;
+    int vdac_ = 0;
+    int ac_ = 0;
+    int ar_ = 0;
+    int waveform_ = WT_SINE;
+    float period_ = 1;
+    int sample_clock_us_ = 1000;
+    int low_level_ = 0;
+    int high_level_ = 255;
+    int num_steps_ = 8;
+    int repeat_ = 0;
+    uint64_t cycle_ = 0;
+    uint32_t time_ms_ = 0;
+    bool enable_waveform_ = 0;
+    unsigned heartbeat_timer_count_ = 0;
+    unsigned progress_timer_count_ = 0;
+};